@@ -0,0 +1,441 @@
+#include <algorithm>
+#include <argp.h>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "Grid.h"
+#include "Hull.h"
+#include "ImageSource.h"
+#include "Marker.h"
+#include "Mesh.h"
+#include "Segmentation.h"
+#include "Synthetic.h"
+
+// Microbenchmarks for the hot paths of the pipeline. All inputs come from res/, so results are reproducible
+// between runs and machines (apart from the hardware, obviously).
+
+struct BenchArguments {
+	std::string res = "res";
+	std::vector<int> dims{64, 128, 256, 512};
+	std::vector<double> scales{1.0, 0.5, 0.25};
+	int repetitions = 5;
+	std::string filter;
+
+	std::string shape = "sphere";
+	int views = 360;
+	double syntheticScale = 0.25;
+	std::optional<std::string> meshDir;
+};
+
+static char doc[] = "microbenchmarks for carving, surface extraction and segmentation";
+
+static struct argp_option options[] = {
+    {"res", 'r', "dir", 0, "resource directory with params.yaml and the test images (default res)", 0},
+    {"dims", 'd', "list", 0, "comma separated grid dimensions (default 64,128,256,512)", 0},
+    {"scales", 's', "list", 0, "comma separated frame scales relative to the test image (default 1,0.5,0.25)", 0},
+    {"repetitions", 'n', "count", 0, "repetitions per benchmark (default 5)", 0},
+    {"filter", 'f', "name", 0, "only run benchmarks whose name contains this string", 0},
+    {"shape", 'S', "name", 0, "synthetic shape: sphere, box, cylinder or dumbbell (default sphere)", 1},
+    {"views", 'v', "count", 0, "number of synthetic views (default 360)", 1},
+    {"synthetic-scale", 'x', "scale", 0, "synthetic mask size relative to params.yaml (default 0.25)", 1},
+    {"meshes", 'm', "dir", 0, "write the expected and the carved synthetic meshes to this directory", 1},
+    { 0, 0, 0, 0, 0, 0 }
+};
+
+template<typename T>
+static bool parse_list(const char *arg, std::vector<T> &out) {
+	out.clear();
+	std::stringstream ss(arg);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		std::stringstream is(item);
+		T value;
+		if (!(is >> value) || value <= 0) return false;
+		out.push_back(value);
+	}
+	return !out.empty();
+}
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+	auto &args = *reinterpret_cast<BenchArguments *>(state->input);
+	switch (key) {
+		case 'r':
+			args.res = arg;
+			break;
+		case 'd':
+			if (!parse_list(arg, args.dims)) return EINVAL;
+			break;
+		case 's':
+			if (!parse_list(arg, args.scales)) return EINVAL;
+			break;
+		case 'n':
+			args.repetitions = std::atoi(arg);
+			if (args.repetitions <= 0) return EINVAL;
+			break;
+		case 'f':
+			args.filter = arg;
+			break;
+		case 'S':
+			args.shape = arg;
+			break;
+		case 'v':
+			args.views = std::atoi(arg);
+			if (args.views <= 0) return EINVAL;
+			break;
+		case 'x':
+			args.syntheticScale = std::atof(arg);
+			if (args.syntheticScale <= 0) return EINVAL;
+			break;
+		case 'm':
+			args.meshDir = arg;
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argp = {options, parse_opt, 0, doc, 0, 0, 0};
+
+/// Runs `fn` repeatedly and prints the median and minimum wall time. `setup` runs before every repetition and is
+/// not measured.
+class Bench {
+private:
+	const BenchArguments &args;
+
+public:
+	explicit Bench(const BenchArguments &args) : args(args) {
+		std::cout << std::left << std::setw(40) << "benchmark" << std::setw(14) << "median [ms]" << "min [ms]" << '\n';
+	}
+
+	bool enabled(const std::string &name) const {
+		return args.filter.empty() || name.find(args.filter) != std::string::npos;
+	}
+
+	void run(const std::string &name, const std::function<void()> &setup, const std::function<void()> &fn) {
+		if (!enabled(name)) return;
+
+		std::vector<double> times;
+		for (int r = 0; r < args.repetitions; r++) {
+			setup();
+			auto start = std::chrono::steady_clock::now();
+			fn();
+			auto end = std::chrono::steady_clock::now();
+			times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+		}
+		std::sort(times.begin(), times.end());
+		std::cout << std::left << std::setw(40) << name << std::setw(14) << std::fixed << std::setprecision(3)
+		          << times[times.size() / 2] << times.front() << std::endl;
+	}
+
+	void run(const std::string &name, const std::function<void()> &fn) {
+		run(name, [] {}, fn);
+	}
+
+	/// Print a result that was measured by the caller.
+	void report(const std::string &name, double ms, const std::string &extra) {
+		std::cout << std::left << std::setw(40) << name << std::setw(14) << std::fixed << std::setprecision(3)
+		          << ms << extra << std::endl;
+	}
+};
+
+static std::string size_name(const cv::Mat &m) {
+	return std::to_string(m.cols) + "x" + std::to_string(m.rows);
+}
+
+/// Carve an orbit of exact silhouettes of an analytic shape, bypassing marker detection and segmentation.
+/// Only carving is timed, the result is compared against the known occupancy.
+static bool run_synthetic(const BenchArguments &args, const std::string &config, Bench &bench) {
+	auto shape = Shape::Create(args.shape, 0.1);
+	if (!shape) {
+		std::cerr << "unknown shape " << args.shape << std::endl;
+		return false;
+	}
+
+	cv::FileStorage fs(config, cv::FileStorage::READ);
+	cv::Mat cameraMatrix;
+	int width = 0, height = 0;
+	fs["camera_matrix"] >> cameraMatrix;
+	fs["image_width"] >> width;
+	fs["image_height"] >> height;
+	cv::Size size(static_cast<int>(width * args.syntheticScale), static_cast<int>(height * args.syntheticScale));
+	SyntheticScene scene(*shape, ScaleCameraMatrix(cameraMatrix, args.syntheticScale, args.syntheticScale), size);
+	auto poses = OrbitPoses(args.views, 0.4, -0.3, 1.2);
+
+	for (int dim : args.dims) {
+		std::string name = "Synthetic/" + args.shape + "/" + std::to_string(dim) + "/" + std::to_string(args.views);
+		std::string batchName = "SyntheticViews/" + args.shape + "/" + std::to_string(dim) + "/" + std::to_string(args.views);
+		std::string linesName = "SyntheticLines/" + args.shape + "/" + std::to_string(dim) + "/" + std::to_string(args.views);
+		std::string hullName = "SyntheticHull/" + args.shape + "/" + std::to_string(dim) + "/" + std::to_string(args.views);
+		if (!bench.enabled(name) && !bench.enabled(batchName) && !bench.enabled(linesName) && !bench.enabled(hullName))
+			continue;
+
+		Grid grid(dim, 0.1f, 0.1f, 0.1f);
+		cv::Mat mask, colors;
+		double carveMs = 0;
+		for (auto &pose : poses) {
+			scene.render(pose, mask);
+			cv::cvtColor(mask, colors, cv::COLOR_GRAY2BGR);
+
+			auto start = std::chrono::steady_clock::now();
+			grid.CarveMaskColor(pose.translation, pose.rotation, mask, scene.get_camera_matrix(), cv::Mat(), colors);
+			carveMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		size_t missing;
+		double iou = scene.accuracy(grid, missing);
+		std::stringstream extra;
+		extra << std::fixed << std::setprecision(1) << args.views / carveMs * 1000 << " views/s, IoU "
+		      << std::setprecision(4) << iou << ", " << missing << " shape voxels lost";
+		if (bench.enabled(name)) bench.report(name, carveMs, extra.str());
+
+		std::vector<Grid::View> views;
+		if (bench.enabled(batchName) || bench.enabled(linesName) || bench.enabled(hullName)) {
+			for (auto &pose : poses) {
+				cv::Mat viewMask, viewColors;
+				scene.render(pose, viewMask);
+				cv::cvtColor(viewMask, viewColors, cv::COLOR_GRAY2BGR);
+				views.push_back({pose.translation, pose.rotation, viewMask, scene.get_camera_matrix(), cv::Mat(), viewColors});
+			}
+		}
+
+		// the same orbit carved concurrently, the occupancy has to match the sequential result exactly
+		if (bench.enabled(batchName)) {
+			for (VoxelLayout layout : {VoxelLayout::Linear, VoxelLayout::Morton}) {
+				if (layout == VoxelLayout::Morton && !SupportsMorton(dim)) continue;
+				Grid batch(dim, 0.1f, 0.1f, 0.1f, layout);
+				auto start = std::chrono::steady_clock::now();
+				batch.CarveViews(views);
+				double batchMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+				std::stringstream batchExtra;
+				batchExtra << std::fixed << std::setprecision(1) << args.views / batchMs * 1000 << " views/s, "
+				           << (batch.voxels.count() == grid.voxels.count() ? "same" : "DIFFERENT") << " occupancy";
+				bench.report(batchName + (layout == VoxelLayout::Morton ? "/morton" : ""), batchMs, batchExtra.str());
+			}
+		}
+
+		// rows of voxels rasterized through the masks, only voxels on pixel borders may differ from projecting them
+		if (bench.enabled(linesName)) {
+			Grid lines(dim, 0.1f, 0.1f, 0.1f);
+			auto start = std::chrono::steady_clock::now();
+			lines.CarveViews(views, true);
+			double linesMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			size_t differing = 0;
+			for (size_t index = 0; index < lines.voxels.size(); index++) {
+				differing += lines.voxels[index] != grid.voxels[index];
+			}
+			size_t linesMissing;
+			double linesIou = scene.accuracy(lines, linesMissing);
+			std::stringstream linesExtra;
+			linesExtra << std::fixed << std::setprecision(1) << args.views / linesMs * 1000 << " views/s, IoU "
+			           << std::setprecision(4) << linesIou << ", " << differing << " voxels differ from projecting";
+			bench.report(linesName, linesMs, linesExtra.str());
+		}
+
+		// contour polygons instead of voxels, the mesh is sampled at the grid dimension
+		if (bench.enabled(hullName)) {
+			ContourHull hull(0.1f, 0.1f, 0.1f);
+			Mesh hullMesh;
+			auto start = std::chrono::steady_clock::now();
+			for (auto &view : views) hull.AddView(view);
+			hull.Extract(hullMesh, dim);
+			double hullMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			Grid hullGrid(dim, 0.1f, 0.1f, 0.1f);
+			hull.Carve(hullGrid);
+			size_t hullMissing;
+			double hullIou = scene.accuracy(hullGrid, hullMissing);
+			std::stringstream hullExtra;
+			hullExtra << hull.EdgeCount() << " contour edges, " << hullMesh.FaceCount() << " faces, IoU " << std::fixed
+			          << std::setprecision(4) << hullIou << ", " << hullMissing << " shape voxels lost";
+			bench.report(hullName, hullMs, hullExtra.str());
+		}
+
+		if (args.meshDir) {
+			std::string prefix = *args.meshDir + "/" + args.shape + "_" + std::to_string(dim);
+			grid.WriteMeshColor(prefix + "_carved.off");
+			Grid expected(dim, 0.1f, 0.1f, 0.1f);
+			scene.voxelize(expected);
+			expected.WriteMeshColor(prefix + "_expected.off");
+		}
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	BenchArguments args;
+	if (argp_parse(&argp, argc, argv, 0, 0, &args))
+		return -1;
+
+	std::string config = args.res + "/params.yaml";
+	cv::Mat image = cv::imread(args.res + "/testObject.jpg", cv::IMREAD_COLOR);
+	if (image.empty()) {
+		std::cerr << "error opening " << args.res << "/testObject.jpg" << std::endl;
+		return -1;
+	}
+	FrameImageSource source(config);
+	source.set_frame(image);
+	if (!source.is_open()) {
+		std::cerr << "error opening " << config << std::endl;
+		return -1;
+	}
+
+	// use the marker pose of the test image, so the grid projects onto the real object.
+	MarkerTracker::loc pose{cv::Vec3d(0, 0, 0.4), cv::Vec3d(CV_PI, 0, 0)};
+	{
+		MarkerDetector detector(0);
+		Marker marker(source, 0.05f, detector);
+		MarkerTracker tracker;
+		if (auto location = tracker.getFirstMarkerLoc(marker)) pose = *location;
+		else std::cerr << "no marker found in the test image, using a fixed pose" << std::endl;
+	}
+
+	// the reference mask for carving, segmented once at full resolution
+	auto chroma = ChromaSegmentation::White();
+	chroma->update(source);
+	cv::Mat mask = chroma->get_mask().clone();
+
+	Bench bench(args);
+
+	for (double scale : args.scales) {
+		cv::Mat scaled;
+		cv::resize(image, scaled, cv::Size(), scale, scale, cv::INTER_AREA);
+		source.set_frame(scaled);
+		std::string suffix = "/" + size_name(scaled);
+
+		auto chromaSeg = ChromaSegmentation::White();
+		bench.run("ChromaSegmentation::update" + suffix, [&] { chromaSeg->update(source); });
+
+		if (bench.enabled("CleanplateSegmentation::update")) {
+			CleanplateSegmentation cleanplate(args.res + "/testMarker.jpg");
+			bench.run("CleanplateSegmentation::update" + suffix, [&] { cleanplate.update(source); });
+		}
+
+		WatershedSegmentation watershed;
+		bench.run("WatershedSegmentation::update" + suffix, [&] { watershed.update(source); });
+	}
+	source.set_frame(image);
+
+	// detection plus pose of the test image, a pose per marker against one solve over the learned board
+	MarkerDetector detector;
+	for (auto mode : {MarkerTracker::Mode::Average, MarkerTracker::Mode::Board}) {
+		MarkerTracker tracker(mode);
+		bench.run(mode == MarkerTracker::Mode::Board ? "Marker/board" : "Marker/average", [&] {
+			Marker marker(source, 0.05f, detector, tracker.needs_single_poses());
+			tracker.getFirstMarkerLoc(marker);
+		});
+	}
+
+	// detection alone on every pyramid level, with the corner error against full resolution detection
+	std::vector<std::vector<cv::Point2f>> reference, levelCorners, rejected;
+	std::vector<int> referenceIds, levelIds;
+	MarkerDetector(0).detect(image, reference, referenceIds, rejected);
+	for (int level = 0; level <= 3; level++) {
+		std::string name = "MarkerDetector::detect/level" + std::to_string(level);
+		if (!bench.enabled(name)) continue;
+		MarkerDetector levelDetector(level);
+		levelDetector.detect(image, levelCorners, levelIds, rejected);
+		auto start = std::chrono::steady_clock::now();
+		levelDetector.detect(image, levelCorners, levelIds, rejected);
+		double detectMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		double error = 0;
+		int matched = 0;
+		for (size_t m = 0; m < levelIds.size(); m++) {
+			auto found = std::find(referenceIds.begin(), referenceIds.end(), levelIds[m]);
+			if (found == referenceIds.end()) continue;
+			auto &expected = reference[found - referenceIds.begin()];
+			for (int c = 0; c < 4; c++) error += cv::norm(levelCorners[m][c] - expected[c]);
+			matched++;
+		}
+		std::stringstream extra;
+		extra << matched << " of " << referenceIds.size() << " markers, mean corner offset " << std::setprecision(3)
+		      << (matched ? error / (4 * matched) : 0.0) << " px";
+		bench.report(name, detectMs, extra.str());
+	}
+
+	// every dimension in both voxel layouts, where Morton is available
+	std::vector<std::pair<int, VoxelLayout>> grids;
+	for (int dim : args.dims) {
+		grids.emplace_back(dim, VoxelLayout::Linear);
+		if (SupportsMorton(dim)) grids.emplace_back(dim, VoxelLayout::Morton);
+	}
+
+	for (auto &entry : grids) {
+		int dim = entry.first;
+		VoxelLayout layout = entry.second;
+		std::string suffix = "/" + std::to_string(dim) + (layout == VoxelLayout::Morton ? "/morton" : "");
+		std::unique_ptr<Grid> grid;
+		auto fresh = [&] { grid = std::make_unique<Grid>(dim, 0.1f, 0.1f, 0.05f, layout); };
+
+		for (double scale : args.scales) {
+			cv::Mat scaledMask;
+			cv::resize(mask, scaledMask, cv::Size(), scale, scale, cv::INTER_NEAREST);
+			bench.run("Grid::CarveMaskColor" + suffix + "/" + size_name(scaledMask), fresh, [&] {
+				grid->CarveMaskColor(pose.translation, pose.rotation, scaledMask, source.get_camera_matrix(),
+				                     source.get_distortion_coefficients(), image);
+			});
+		}
+
+		bench.run("Grid::CarveClipPlane" + suffix, fresh, [&] {
+			grid->CarveClipPlane(cv::Vec3d(1, 1, 1), 0);
+		});
+
+		// the four planes of a frustum looking down z, as Grid::Carve uses them
+		bench.run("Grid::CarveClipPlanes" + suffix, fresh, [&] {
+			grid->CarveClipPlanes({
+				{cv::Vec3d(1, 0, 0.5), -0.01},
+				{cv::Vec3d(-1, 0, 0.5), -0.01},
+				{cv::Vec3d(0, 1, 0.5), -0.01},
+				{cv::Vec3d(0, -1, 0.5), -0.01},
+			});
+		});
+
+		// surface extraction works on a carved grid, otherwise there is no surface but the bounding box.
+		fresh();
+		grid->CarveMaskColor(pose.translation, pose.rotation, mask, source.get_camera_matrix(),
+		                     source.get_distortion_coefficients(), image);
+
+		Mesh mesh;
+		bench.run("MarchingCubes" + suffix, [&] { mesh = Mesh(); }, [&] { MarchingCubes(*grid, mesh); });
+
+		// a corner of the object cut off after the surface was extracted, only the bricks around the cut are redone
+		Grid cut = *grid;
+		LiveMesh live;
+		bench.run("LiveMesh::Update" + suffix, [&] {
+			cut = *grid;
+			live = LiveMesh();
+			live.Update(cut);
+			cut.CarveClipPlane(cv::Vec3d(-1, -1, -1), -0.02);
+		}, [&] { live.Update(cut); });
+
+		bench.run("Mesh::WriteOffColor" + suffix, [&] {
+			std::ostringstream out;
+			mesh.WriteOffColor(out);
+		});
+
+		bench.run("WriteOffColorStreaming" + suffix, [&] {
+			std::ostringstream out;
+			WriteOffColorStreaming(*grid, out);
+		});
+
+		Mesh decimated;
+		DecimateOptions tenth;
+		tenth.targetFaces = mesh.FaceCount() / 10;
+		bench.run("Mesh::Decimate" + suffix, [&] { decimated = mesh; }, [&] { decimated.Decimate(tenth); });
+	}
+
+	if (!run_synthetic(args, config, bench))
+		return -1;
+
+	return 0;
+}
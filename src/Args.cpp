@@ -9,7 +9,7 @@ std::string Arguments::get_output_filepath(const std::string& filename) {
     return ss.str();
 }
 
-static char args_doc[] = "INPUT";
+static char args_doc[] = "INPUT\n--rig=file";
 
 static char doc[] = "creates 3D mesh from RBG input sequence using voxel carving";
 
@@ -75,6 +75,46 @@ static struct argp_option options[] = {
         "use chroma white as background",
         1
     },
+    {
+        "dimension",
+        'D',
+        "voxels",
+        0,
+        "number of voxels along each axis of the grid (default 64)",
+        0
+    },
+    {
+        "fit",
+        'f',
+        "views",
+        0,
+        "allocate the grid around the visual hull of the first this many carved frames instead of the whole volume",
+        2
+    },
+    {
+        "layout",
+        'L',
+        "order",
+        0,
+        "order of the voxels in memory: linear (default) or morton (bricks along a Z-curve, for 64, 128, 256 and 512)",
+        2
+    },
+    {
+        "shards",
+        'S',
+        "count",
+        0,
+        "carve the grid in this many processes, each holding only a slab of it, for grids that do not fit into memory",
+        2
+    },
+    {
+        "shard-worker",
+        'W',
+        "index",
+        OPTION_HIDDEN,
+        "carve one shard of the views written to the output directory (started by --shards)",
+        2
+    },
     {
         "markerlength",
         'l',
@@ -83,6 +123,194 @@ static struct argp_option options[] = {
         "length of ArUco markers in meters",
         0
     },
+    {
+        "board",
+        'P',
+        0,
+        0,
+        "solve one pose from the corners of all markers, in a layout learned from the first frames, instead of "
+        "averaging the poses of single markers",
+        0
+    },
+    {
+        "marker-level",
+        'K',
+        "level",
+        0,
+        "search markers on frames downscaled by 2^level and refine their corners at full resolution (default: the lowest "
+        "level at most 2048 pixels wide)",
+        0
+    },
+    {
+        "mask-resolution",
+        'x',
+        "pixels",
+        0,
+        "segment at the lowest resolution where a voxel still covers this many pixels (default 2, 0 for full resolution)",
+        1
+    },
+    {
+        "keyframe-angle",
+        'a',
+        "degrees",
+        0,
+        "only carve frames where the camera rotated at least this much since the last carved frame",
+        2
+    },
+    {
+        "keyframe-distance",
+        'd',
+        "meters",
+        0,
+        "only carve frames where the camera moved at least this far since the last carved frame",
+        2
+    },
+    {
+        "keyframe-max-skip",
+        'm',
+        "frames",
+        0,
+        "carve at least every n-th frame regardless of the camera motion (default 30)",
+        2
+    },
+    {
+        "realtime",
+        't',
+        "ms",
+        0,
+        "time budget per frame for a camera (device index input), drops stale frames and reduces quality when exceeded",
+        2
+    },
+    {
+        "carve-batch",
+        'C',
+        "frames",
+        0,
+        "carve this many frames concurrently, for recorded input (default 1)",
+        2
+    },
+    {
+        "rasterize",
+        'Z',
+        0,
+        0,
+        "carve rows of voxels by walking their projected line through the mask instead of projecting every voxel",
+        2
+    },
+    {
+        "hull",
+        'H',
+        "pixels",
+        0,
+        "intersect the silhouette contours, simplified to this many pixels, instead of carving voxels. The dimension "
+        "only samples the topology of the mesh, rigs do not apply. Can not be combined with checkpoints or shards",
+        2
+    },
+    {
+        "converge",
+        'V',
+        "frames",
+        0,
+        "stop reading the input once this many carved frames in a row each removed fewer than --converge-voxels voxels",
+        2
+    },
+    {
+        "converge-voxels",
+        'v',
+        "count",
+        0,
+        "voxels a carved frame has to remove to not count towards --converge (default 1)",
+        2
+    },
+    {
+        "replay",
+        'j',
+        "file",
+        0,
+        "run without display and write a JSON report with throughput and latencies to this file",
+        3
+    },
+    {
+        "baseline",
+        'B',
+        "file",
+        0,
+        "fail if the replay throughput is below the one of this earlier report",
+        3
+    },
+    {
+        "tolerance",
+        'T',
+        "fraction",
+        0,
+        "allowed throughput loss against the baseline (default 0.1)",
+        3
+    },
+    {
+        "no-mesh",
+        'M',
+        0,
+        0,
+        "do not write the mesh at the end",
+        3
+    },
+    {
+        "live-mesh",
+        'u',
+        0,
+        0,
+        "keep the mesh up to date while carving, extracting only the parts of the grid that lost voxels (the colors "
+        "of the other parts lag behind until the end, where every part is extracted again for the written mesh)",
+        3
+    },
+    {
+        "decimate-faces",
+        'F',
+        "count",
+        0,
+        "reduce the mesh to this many faces before writing it",
+        3
+    },
+    {
+        "decimate-error",
+        'E',
+        "meters",
+        0,
+        "reduce the mesh as long as the surface moves less than this distance",
+        3
+    },
+    {
+        "checkpoint",
+        'k',
+        "file",
+        0,
+        "periodically save the reconstruction state to this file",
+        2
+    },
+    {
+        "checkpoint-interval",
+        'n',
+        "frames",
+        0,
+        "number of frames between two checkpoints (default 500)",
+        2
+    },
+    {
+        "resume",
+        'r',
+        0,
+        0,
+        "continue from the checkpoint file instead of starting at the first frame",
+        2
+    },
+    {
+        "rig",
+        'R',
+        "file",
+        0,
+        "read several synchronized cameras described in this file instead of INPUT and --config",
+        0
+    },
     { 0, 0, 0, 0, 0, 0 }
 };
 
@@ -137,12 +365,156 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case 'w':
             args.mode = SegmentMode::ChromaWhite;
             break;
+        case 'D':
+            args.dimension = (int) std::strtol(arg, &ptr, 10);
+            if (*ptr || args.dimension <= 0) {
+                return EINVAL;
+            }
+            break;
+        case 'f':
+            args.fit = (int) std::strtol(arg, &ptr, 10);
+            if (*ptr || *args.fit <= 0) {
+                return EINVAL;
+            }
+            break;
+        case 'L':
+            if (strcmp(arg, "linear") == 0) {
+                args.layout = VoxelLayout::Linear;
+            } else if (strcmp(arg, "morton") == 0) {
+                args.layout = VoxelLayout::Morton;
+            } else {
+                return EINVAL;
+            }
+            break;
+        case 'S':
+            args.shards = (int) std::strtol(arg, &ptr, 10);
+            if (*ptr || args.shards <= 0) {
+                return EINVAL;
+            }
+            break;
+        case 'W':
+            args.shardWorker = (int) std::strtol(arg, &ptr, 10);
+            if (*ptr || *args.shardWorker < 0) {
+                return EINVAL;
+            }
+            break;
         case 'l':
             args.markerLength = strtof(arg, &ptr);
             if (*ptr) {
                 return EINVAL;
             }
         break;
+        case 'P':
+            args.board = true;
+            break;
+        case 'K':
+            args.markerLevel = (int) std::strtol(arg, &ptr, 10);
+            if (*ptr || args.markerLevel < 0) {
+                return EINVAL;
+            }
+            break;
+        case 'x':
+            args.maskResolution = strtof(arg, &ptr);
+            if (*ptr || args.maskResolution < 0) {
+                return EINVAL;
+            }
+            break;
+        case 'a':
+            args.keyframeAngle = strtof(arg, &ptr);
+            if (*ptr || args.keyframeAngle < 0) {
+                return EINVAL;
+            }
+            break;
+        case 'd':
+            args.keyframeDistance = strtof(arg, &ptr);
+            if (*ptr || args.keyframeDistance < 0) {
+                return EINVAL;
+            }
+            break;
+        case 'm':
+            args.keyframeMaxSkip = (int) std::strtol(arg, &ptr, 10);
+            if (*ptr || args.keyframeMaxSkip < 0) {
+                return EINVAL;
+            }
+            break;
+        case 't':
+            args.realtimeBudget = strtof(arg, &ptr);
+            if (*ptr || *args.realtimeBudget <= 0) {
+                return EINVAL;
+            }
+            break;
+        case 'C':
+            args.carveBatch = (int) std::strtol(arg, &ptr, 10);
+            if (*ptr || args.carveBatch <= 0) {
+                return EINVAL;
+            }
+            break;
+        case 'Z':
+            args.rasterize = true;
+            break;
+        case 'H':
+            args.hull = strtof(arg, &ptr);
+            if (*ptr || *args.hull < 0) {
+                return EINVAL;
+            }
+            break;
+        case 'V':
+            args.converge = (int) std::strtol(arg, &ptr, 10);
+            if (*ptr || *args.converge <= 0) {
+                return EINVAL;
+            }
+            break;
+        case 'v':
+            args.convergeVoxels = std::strtoul(arg, &ptr, 10);
+            if (*ptr) {
+                return EINVAL;
+            }
+            break;
+        case 'j':
+            args.replay = arg;
+            break;
+        case 'B':
+            args.baseline = arg;
+            break;
+        case 'T':
+            args.tolerance = strtof(arg, &ptr);
+            if (*ptr || args.tolerance < 0 || args.tolerance >= 1) {
+                return EINVAL;
+            }
+            break;
+        case 'M':
+            args.noMesh = true;
+            break;
+        case 'u':
+            args.liveMesh = true;
+            break;
+        case 'F':
+            args.decimate.targetFaces = std::strtoul(arg, &ptr, 10);
+            if (*ptr || args.decimate.targetFaces == 0) {
+                return EINVAL;
+            }
+            break;
+        case 'E':
+            args.decimate.maxError = strtof(arg, &ptr);
+            if (*ptr || args.decimate.maxError <= 0) {
+                return EINVAL;
+            }
+            break;
+        case 'k':
+            args.checkpoint = arg;
+            break;
+        case 'n':
+            args.checkpointInterval = (int) std::strtol(arg, &ptr, 10);
+            if (*ptr || args.checkpointInterval <= 0) {
+                return EINVAL;
+            }
+            break;
+        case 'r':
+            args.resume = true;
+            break;
+        case 'R':
+            args.rig = arg;
+            break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
@@ -152,10 +524,54 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 int parse_args(Arguments& args, int argc, char** argv) {
     args.input = nullptr;
     args.output = ".";
+    args.dimension = 64;
+    args.layout = VoxelLayout::Linear;
+    args.shards = 1;
     args.markerLength = 0.05;
+    args.board = false;
+    args.markerLevel = -1;
+    args.maskResolution = 2;
+    args.keyframeAngle = 0;
+    args.keyframeDistance = 0;
+    args.keyframeMaxSkip = 30;
+    args.carveBatch = 1;
+    args.rasterize = false;
+    args.convergeVoxels = 1;
+    args.tolerance = 0.1;
+    args.noMesh = false;
+    args.liveMesh = false;
+    args.checkpointInterval = 500;
+    args.resume = false;
 
 	if (argp_parse(&argp, argc, argv, 0, 0, &args))
 		return -1;
+
+	// workers only read the views written by the main process
+	if (args.shardWorker)
+		return *args.shardWorker < args.shards ? 0 : -1;
+
+	// shards carve after the whole input was read, nothing is left to checkpoint
+	if (args.shards > 1 && (args.rig || args.checkpoint || args.realtimeBudget))
+		return -1;
+	// neither the hull nor the shards carve voxels in this process, there is nothing to count
+	if (args.converge && (args.hull || args.shards > 1))
+		return -1;
+	// the hull and the shards have no grid in this process to follow
+	if (args.liveMesh && (args.hull || args.shards > 1))
+		return -1;
+	// the polygons of the hull are not part of a checkpoint, and there is no grid to split into shards
+	if (args.hull && (args.checkpoint || args.resume || args.shards > 1))
+		return -1;
+	// the bounds are found on the first frames of a single input, before any voxels are carved
+	if (args.fit && (args.hull || args.shards > 1 || args.rig))
+		return -1;
+	// a rig file brings its own inputs and calibrations
+	if (args.rig) {
+		if (args.input.index() != 2 || args.checkpoint || args.realtimeBudget)
+			return -1;
+		return args.baseline && !args.replay ? -1 : 0;
+	}
+
 	// Index 2 is nullptr_t
 	if (args.input.index() == 2)
 		return -1;
@@ -163,5 +579,18 @@ int parse_args(Arguments& args, int argc, char** argv) {
 	if (args.config.length() == 0)
 		return -1;
 
+	if (args.resume && !args.checkpoint)
+		return -1;
+
+	if (args.baseline && !args.replay)
+		return -1;
+
+	// batches delay carving, which defeats a per frame time budget
+	if (args.realtimeBudget && args.carveBatch > 1)
+		return -1;
+	// only a camera (index 1 is a device) has stale frames to drop, recorded input would lose real ones
+	if (args.realtimeBudget && args.input.index() != 1)
+		return -1;
+
 	return 0;
 }
\ No newline at end of file
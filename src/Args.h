@@ -3,14 +3,9 @@
 #include <variant>
 #include <optional>
 #include <string>
-
-enum class SegmentMode {
-	Watershed,
-	ChromaBlue,
-	ChromeGreen,
-	ChromaWhite,
-	FirstFrame,
-};
+#include "Dimension.h"
+#include "Mesh.h"
+#include "Segmentation.h"
 
 struct Arguments {
 	std::variant<std::string, int, std::nullptr_t> input;
@@ -20,7 +15,40 @@ struct Arguments {
     SegmentMode mode;
     std::optional<std::string> cleanPlate;
 
+    int dimension;
+    std::optional<int> fit;
+    VoxelLayout layout;
+    int shards;
+    std::optional<int> shardWorker;
+
     float markerLength;
+    bool board;
+    int markerLevel;
+    float maskResolution;
+
+    float keyframeAngle;
+    float keyframeDistance;
+    int keyframeMaxSkip;
+
+    std::optional<float> realtimeBudget;
+    int carveBatch;
+    bool rasterize;
+    std::optional<float> hull;
+    std::optional<int> converge;
+    size_t convergeVoxels;
+
+    std::optional<std::string> replay;
+    std::optional<std::string> baseline;
+    float tolerance;
+    bool noMesh;
+    bool liveMesh;
+    DecimateOptions decimate;
+
+    std::optional<std::string> checkpoint;
+    int checkpointInterval;
+    bool resume;
+
+    std::optional<std::string> rig;
 
     std::string get_output_filepath(const std::string& filename);
 };
@@ -0,0 +1,54 @@
+#include "Bounds.h"
+
+BoundsEstimator::BoundsEstimator(float x, float y, float z, int dimension) : coarse(dimension, x, y, z) {}
+
+void BoundsEstimator::AddView(const Grid::View &view) {
+	int dim = coarse.dimension;
+	double halfDiagonal = 0.5 * std::sqrt(std::pow(coarse.x_length / dim, 2) + std::pow(coarse.y_length / dim, 2) +
+	                                      std::pow(coarse.z_length / dim, 2));
+	// largest projection of a voxel, from the nearest point of the box (see Grid::MaskLevel)
+	double radius = 0.5 * std::sqrt(coarse.x_length * coarse.x_length + coarse.y_length * coarse.y_length +
+	                                coarse.z_length * coarse.z_length);
+	double depth = std::max(cv::norm(view.translation) - radius, 1e-3);
+	double focal = std::max(view.cameraMatrix.at<double>(0, 0), view.cameraMatrix.at<double>(1, 1));
+	double maskScale = std::max(static_cast<double>(view.mask.cols) / view.image.cols,
+	                            static_cast<double>(view.mask.rows) / view.image.rows);
+	// one more pixel for the rounding of the projected centers, a camera inside the box keeps the whole frame
+	int grow = static_cast<int>(std::ceil(focal * halfDiagonal / depth * maskScale)) + 1;
+	grow = std::min(grow, std::max(view.mask.cols, view.mask.rows));
+
+	// a square contains the disc of the voxel's projection and is dilated much faster
+	cv::dilate(view.mask, grown, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(2 * grow + 1, 2 * grow + 1)));
+	coarse.CarveMaskColor(view.translation, view.rotation, grown, view.cameraMatrix, view.distCoeffs, view.image);
+	views++;
+}
+
+std::optional<GridBounds> BoundsEstimator::Bounds(int margin) const {
+	int dim = coarse.dimension;
+	cv::Vec3i lo(dim, dim, dim), hi(-1, -1, -1);
+	for (int i = 0; i < dim; i++) {
+		for (int j = 0; j < dim; j++) {
+			for (int k = 0; k < dim; k++) {
+				if (!coarse.voxels[coarse.index(i, j, k)]) continue;
+				cv::Vec3i v(i, j, k);
+				for (int a = 0; a < 3; a++) {
+					lo[a] = std::min(lo[a], v[a]);
+					hi[a] = std::max(hi[a], v[a]);
+				}
+			}
+		}
+	}
+	if (hi[0] < 0) return {};
+
+	cv::Vec3f lengths(coarse.x_length, coarse.y_length, coarse.z_length);
+	GridBounds box;
+	for (int a = 0; a < 3; a++) {
+		float voxel = lengths[a] / dim;
+		float start = coarse.center[a] - lengths[a] / 2;
+		float begin = start + std::max(lo[a] - margin, 0) * voxel;
+		float end = start + std::min(hi[a] + 1 + margin, dim) * voxel;
+		box.center[a] = (begin + end) / 2;
+		box.size[a] = end - begin;
+	}
+	return box;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <optional>
+#include <opencv2/opencv.hpp>
+
+#include "Grid.h"
+
+/// Axis aligned box in marker space.
+struct GridBounds {
+	cv::Vec3f center;
+	cv::Vec3f size;
+};
+
+/// Bounds the object from the first silhouettes, so that the real grid can be allocated tightly around it instead of
+/// spending most voxels on empty space. The views carve a coarse grid over the whole initial box, with every mask
+/// grown by the projected size of a coarse voxel: a voxel only goes when no part of it can lie inside the silhouette,
+/// so the box of the remaining voxels contains the visual hull of these views and therefore the object.
+class BoundsEstimator {
+private:
+	Grid coarse;
+	int views = 0;
+	cv::Mat grown;
+
+public:
+	/// The initial box is centered on the first marker, as with a Grid of these lengths.
+	BoundsEstimator(float x, float y, float z, int dimension = 32);
+
+	/// Carve the coarse grid with one view, same arguments as Grid::CarveMaskColor.
+	void AddView(const Grid::View &view);
+
+	inline int ViewCount() const { return views; }
+
+	/// The coarse grid over the initial box, e.g. for Grid::MaskLevel.
+	inline const Grid &get_grid() const { return coarse; }
+
+	/// Box of the remaining voxels, grown by `margin` coarse voxels on every side and clipped to the initial box.
+	/// Nothing when the views removed every voxel (e.g. an empty segmentation).
+	std::optional<GridBounds> Bounds(int margin = 1) const;
+};
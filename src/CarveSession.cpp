@@ -0,0 +1,67 @@
+#include "CarveSession.h"
+
+CarveSession::CarveSession(Options o)
+		: options(std::move(o)), source(options.calibration),
+		  segmentation(Segmentation::Create(options.mode, options.cleanPlate)), detector(options.markerLevel),
+		  keyframes(options.keyframeAngle * CV_PI / 180.0, options.keyframeDistance, options.keyframeMaxSkip) {
+	reset();
+}
+
+bool CarveSession::is_open() const {
+	return source.is_open() && segmentation;
+}
+
+bool CarveSession::feed(const cv::Mat &frame, const cv::Mat &mask, const std::optional<MarkerTracker::loc> &pose) {
+	source.set_frame(frame);
+
+	auto location = pose;
+	if (!location) {
+		Marker marker(source, options.markerLength, detector, tracker.needs_single_poses());
+		location = tracker.getFirstMarkerLoc(marker);
+	}
+	if (!location || !keyframes.accept(*location)) return false;
+
+	const cv::Mat *silhouette = &mask;
+	if (mask.empty()) {
+		if (!segmentation) return false;
+		int level = 0;
+		if (options.maskResolution > 0)
+			level = grid->MaskLevel(source.get_camera_matrix(), location->translation, options.maskResolution, 4);
+		segmentation->set_level(level);
+		segmentation->update(source);
+		silhouette = &segmentation->get_mask();
+	}
+
+	if (options.rasterize) {
+		lastRemoved = grid->CarveViews({{location->translation, location->rotation, *silhouette,
+		                                 source.get_camera_matrix(), source.get_distortion_coefficients(), frame}},
+		                               true);
+	}
+	else {
+		lastRemoved = grid->CarveMaskColor(location->translation, location->rotation, *silhouette,
+		                                   source.get_camera_matrix(), source.get_distortion_coefficients(), frame);
+	}
+	carvedFrames++;
+	return true;
+}
+
+void CarveSession::extract_mesh(Mesh &mesh) {
+	surface.Update(*grid);
+	surface.Extract(mesh);
+}
+
+bool CarveSession::write_mesh(const std::string &filename) const {
+	return grid->WriteMeshColor(filename, options.decimate);
+}
+
+void CarveSession::reset() {
+	grid = std::make_unique<Grid>(options.dimension, options.x_length, options.y_length, options.z_length,
+	                              options.layout);
+	tracker = MarkerTracker(options.markerMode);
+	keyframes = KeyframeSelector(options.keyframeAngle * CV_PI / 180.0, options.keyframeDistance,
+	                             options.keyframeMaxSkip);
+	// the surface of the old grid, the next update extracts the new one from scratch
+	surface = LiveMesh();
+	carvedFrames = 0;
+	lastRemoved = 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+#include "Grid.h"
+#include "ImageSource.h"
+#include "Keyframe.h"
+#include "Marker.h"
+#include "Mesh.h"
+#include "Segmentation.h"
+
+/// Voxel carving without any GUI, for embedding the reconstruction into other applications.
+/// Calibration, segmentation and marker detection are set up once, frames are fed one by one and the mesh can be
+/// extracted at any time. reset() starts the next object with the same setup.
+class CarveSession {
+public:
+	struct Options {
+		std::string calibration;
+
+		int dimension = 64;
+		VoxelLayout layout = VoxelLayout::Linear;
+		float x_length = 0.1f, y_length = 0.1f, z_length = 0.05f;
+
+		SegmentMode mode = SegmentMode::ChromaWhite;
+		std::optional<std::string> cleanPlate{};
+		/// see Grid::MaskLevel, 0 segments at full resolution
+		float maskResolution = 2;
+
+		float markerLength = 0.05f;
+		/// see MarkerTracker::Mode
+		MarkerTracker::Mode markerMode = MarkerTracker::Mode::Average;
+		/// see MarkerDetector
+		int markerLevel = -1;
+		/// see KeyframeSelector, the defaults carve every frame
+		float keyframeAngle = 0, keyframeDistance = 0;
+		int keyframeMaxSkip = 0;
+		/// see Grid::CarveViews
+		bool rasterize = false;
+
+		/// applied by write_mesh, the default keeps every face
+		DecimateOptions decimate{};
+	};
+
+private:
+	Options options;
+	FrameImageSource source;
+	std::unique_ptr<Segmentation> segmentation;
+	std::unique_ptr<Grid> grid;
+	MarkerDetector detector;
+	MarkerTracker tracker;
+	KeyframeSelector keyframes;
+	int carvedFrames = 0;
+	size_t lastRemoved = 0;
+	/// follows the grid once the mesh was extracted, so later extractions only redo the changed parts
+	LiveMesh surface;
+
+public:
+	explicit CarveSession(Options options);
+
+	/// Whether the calibration and the segmentation could be loaded.
+	bool is_open() const;
+
+	/// Carve with one frame (BGR). Without a pose, the pose is estimated from the markers in the frame. Without a
+	/// mask, the frame is segmented. The mask may be smaller than the frame (lower pyramid level).
+	/// Returns whether the frame was carved, it is not when there is no pose or the camera did not move enough.
+	bool feed(const cv::Mat &frame, const cv::Mat &mask = cv::Mat(),
+	          const std::optional<MarkerTracker::loc> &pose = std::nullopt);
+
+	inline const Grid &get_grid() const { return *grid; }
+
+	inline int get_carved_frames() const { return carvedFrames; }
+
+	/// Voxels removed by the last carved frame, see ConvergenceMonitor for deciding when to stop feeding frames.
+	inline size_t get_last_removed() const { return lastRemoved; }
+
+	/// The surface of the current grid. Repeated calls only extract the parts of the grid that changed in between
+	/// again, the other faces keep their colors (see LiveMesh). Not const, it updates the surface and the change
+	/// tracking of the grid.
+	void extract_mesh(Mesh &mesh);
+
+	bool write_mesh(const std::string &filename) const;
+
+	/// Start a new reconstruction, keeping calibration and segmentation.
+	void reset();
+};
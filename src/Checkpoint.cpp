@@ -0,0 +1,73 @@
+#include "Checkpoint.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+static const char checkpointMagic[8] = {'3', 'D', 'S', 'M', 'C', 'C', 'K', '2'};
+
+static bool WriteCheckpoint(const std::string &path, int frame, const Grid &grid, const MarkerTracker &tracker) {
+	// write to a temporary file first, so a crash while writing never destroys the previous checkpoint.
+	std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) return false;
+
+		int32_t frameIdx = frame;
+		out.write(checkpointMagic, sizeof(checkpointMagic));
+		out.write(reinterpret_cast<const char *>(&frameIdx), sizeof(frameIdx));
+		if (!grid.Save(out) || !tracker.save(out)) return false;
+		out.flush();
+		if (!out) return false;
+	}
+	return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+CheckpointWriter::CheckpointWriter(std::string p)
+		: path(std::move(p)), worker(&CheckpointWriter::run, this) {}
+
+CheckpointWriter::~CheckpointWriter() {
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	worker.join();
+}
+
+void CheckpointWriter::submit(int frame, const Grid &grid, const MarkerTracker &tracker) {
+	auto snapshot = std::make_unique<Snapshot>(Snapshot{frame, grid, tracker});
+	{
+		std::lock_guard lock(mutex);
+		pending = std::move(snapshot);
+	}
+	wake.notify_one();
+}
+
+void CheckpointWriter::run() {
+	std::unique_lock lock(mutex);
+	while (true) {
+		wake.wait(lock, [this] { return pending || stopping; });
+		if (!pending) break;
+
+		auto snapshot = std::move(pending);
+		lock.unlock();
+		if (!WriteCheckpoint(path, snapshot->frame, snapshot->grid, snapshot->tracker)) {
+			std::cerr << "Failed to write checkpoint " << path << std::endl;
+		}
+		lock.lock();
+	}
+}
+
+std::optional<int> LoadCheckpoint(const std::string &path, Grid &grid, MarkerTracker &tracker) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in.is_open()) return {};
+
+	char magic[sizeof(checkpointMagic)];
+	int32_t frame;
+	in.read(magic, sizeof(magic));
+	in.read(reinterpret_cast<char *>(&frame), sizeof(frame));
+	if (!in || std::memcmp(magic, checkpointMagic, sizeof(magic)) != 0) return {};
+
+	if (!grid.Load(in) || !tracker.load(in)) return {};
+	return frame;
+}
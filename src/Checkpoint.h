@@ -0,0 +1,46 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "Grid.h"
+#include "Marker.h"
+
+/// Periodically persists the reconstruction state so that long inputs can be resumed after a failure.
+/// Submitting only copies the state, serializing and writing the file happens on a background thread.
+class CheckpointWriter {
+private:
+	struct Snapshot {
+		int frame;
+		Grid grid;
+		MarkerTracker tracker;
+	};
+
+	std::string path;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::unique_ptr<Snapshot> pending;
+	bool stopping = false;
+
+	std::thread worker;
+
+	void run();
+
+public:
+	explicit CheckpointWriter(std::string path);
+
+	/// Writes the last submitted snapshot before returning.
+	~CheckpointWriter();
+
+	/// Queue the state after `frame` was processed. A snapshot that has not been written yet is replaced.
+	void submit(int frame, const Grid &grid, const MarkerTracker &tracker);
+};
+
+/// Restore a checkpoint into an already constructed grid and tracker.
+/// Returns the index of the last processed frame, or nothing if the file is missing or does not match the grid.
+std::optional<int> LoadCheckpoint(const std::string &path, Grid &grid, MarkerTracker &tracker);
@@ -0,0 +1,374 @@
+#include "Mesh.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <opencv2/opencv.hpp>
+
+// Quadric error decimation (Garland & Heckbert): every vertex accumulates the planes of its faces, an edge collapse
+// moves both vertices to the point with the smallest summed squared distance to all these planes.
+//
+// Collapses are independent as long as they touch different faces, so the mesh is split into spatial clusters that
+// are decimated in parallel. Vertices of faces crossing a cluster border are locked. A second round with shifted
+// clusters reaches the former borders, a last serial round with a single cluster meets the exact target.
+
+namespace {
+
+struct Quadric {
+	// symmetric 4x4 matrix: a00 a01 a02 a11 a12 a22, b0 b1 b2, c
+	double q[10] = {};
+	/// sum of the plane weights, error / weight is the weighted mean squared distance to the planes
+	double weight = 0;
+
+	static Quadric Plane(const cv::Vec3d &n, double d, double weight) {
+		Quadric r;
+		r.q[0] = n[0] * n[0] * weight;
+		r.q[1] = n[0] * n[1] * weight;
+		r.q[2] = n[0] * n[2] * weight;
+		r.q[3] = n[1] * n[1] * weight;
+		r.q[4] = n[1] * n[2] * weight;
+		r.q[5] = n[2] * n[2] * weight;
+		r.q[6] = n[0] * d * weight;
+		r.q[7] = n[1] * d * weight;
+		r.q[8] = n[2] * d * weight;
+		r.q[9] = d * d * weight;
+		r.weight = weight;
+		return r;
+	}
+
+	Quadric &operator+=(const Quadric &o) {
+		for (int i = 0; i < 10; i++) q[i] += o.q[i];
+		weight += o.weight;
+		return *this;
+	}
+
+	double error(const cv::Vec3d &p) const {
+		double x = p[0], y = p[1], z = p[2];
+		return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + q[3] * y * y + 2 * q[4] * y * z + q[5] * z * z +
+		       2 * (q[6] * x + q[7] * y + q[8] * z) + q[9];
+	}
+
+	/// Point with the smallest error, false if the quadric is (nearly) singular, e.g. for flat areas.
+	bool optimum(cv::Vec3d &p) const {
+		double a = q[0], b = q[1], c = q[2], d = q[3], e = q[4], f = q[5];
+		double det = a * (d * f - e * e) - b * (b * f - c * e) + c * (b * e - c * d);
+		double scale = (a + d + f) / 3;
+		if (std::abs(det) <= 1e-9 * scale * scale * scale || scale <= 0) return false;
+		// A^-1 * -b by the adjugate
+		double i00 = d * f - e * e, i01 = c * e - b * f, i02 = b * e - c * d;
+		double i11 = a * f - c * c, i12 = b * c - a * e, i22 = a * d - b * b;
+		p = cv::Vec3d(-(i00 * q[6] + i01 * q[7] + i02 * q[8]) / det,
+		              -(i01 * q[6] + i11 * q[7] + i12 * q[8]) / det,
+		              -(i02 * q[6] + i12 * q[7] + i22 * q[8]) / det);
+		return true;
+	}
+};
+
+struct Collapse {
+	/// mean squared distance of the target to the planes of both vertices, weighted by face area
+	double cost;
+	size_t from, to;
+	unsigned fromStamp, toStamp;
+	cv::Vec3d target;
+
+	bool operator<(const Collapse &o) const { return cost > o.cost; }
+};
+
+class Decimator {
+public:
+	std::vector<cv::Vec3d> pos;
+	std::vector<std::array<size_t, 3>> faces;
+	std::vector<char> faceAlive;
+	std::vector<std::vector<size_t>> vertFaces;
+	std::vector<Quadric> quadrics;
+	std::vector<unsigned> stamps;
+	/// vertices on open borders of the mesh, never moved
+	std::vector<char> border;
+	size_t aliveFaces = 0;
+
+	void build() {
+		vertFaces.assign(pos.size(), {});
+		quadrics.assign(pos.size(), Quadric());
+		stamps.assign(pos.size(), 0);
+		border.assign(pos.size(), 0);
+		faceAlive.assign(faces.size(), 1);
+		aliveFaces = faces.size();
+
+		std::unordered_map<uint64_t, int> edgeUse;
+		for (size_t f = 0; f < faces.size(); f++) {
+			auto &t = faces[f];
+			cv::Vec3d n = (pos[t[1]] - pos[t[0]]).cross(pos[t[2]] - pos[t[0]]);
+			double area = cv::norm(n);
+			if (area > 0) {
+				n /= area;
+				// area weighted, large faces constrain the surface more
+				Quadric plane = Quadric::Plane(n, -n.dot(pos[t[0]]), area / 2);
+				for (size_t v : t) quadrics[v] += plane;
+			}
+			for (int e = 0; e < 3; e++) {
+				vertFaces[t[e]].push_back(f);
+				uint64_t a = std::min(t[e], t[(e + 1) % 3]), b = std::max(t[e], t[(e + 1) % 3]);
+				edgeUse[a << 32 | b]++;
+			}
+		}
+		for (auto &[edge, use] : edgeUse) {
+			if (use != 2) border[edge >> 32] = border[edge & 0xFFFFFFFFu] = 1;
+		}
+	}
+
+	static bool contains(const std::array<size_t, 3> &t, size_t v) {
+		return t[0] == v || t[1] == v || t[2] == v;
+	}
+
+	void neighbours(size_t v, std::vector<size_t> &out) const {
+		out.clear();
+		for (size_t f : vertFaces[v]) {
+			if (!faceAlive[f]) continue;
+			for (size_t w : faces[f]) {
+				if (w != v) out.push_back(w);
+			}
+		}
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	}
+
+	/// Cheapest way to collapse the edge, moving `from` onto `to`. Locked vertices keep their position.
+	bool plan(size_t a, size_t b, const std::vector<char> &locked, Collapse &c) const {
+		if (locked[a] && locked[b]) return false;
+		size_t from = locked[a] ? b : a, to = locked[a] ? a : b;
+
+		Quadric q = quadrics[from];
+		q += quadrics[to];
+
+		cv::Vec3d best = pos[to];
+		if (!locked[to]) {
+			cv::Vec3d mid = (pos[from] + pos[to]) * 0.5;
+			double length = cv::norm(pos[from] - pos[to]);
+			cv::Vec3d opt;
+			// far away optima of nearly flat areas are numerically meaningless
+			if (q.optimum(opt) && cv::norm(opt - mid) <= length) {
+				best = opt;
+			}
+			else {
+				for (const cv::Vec3d &p : {pos[from], mid}) {
+					if (q.error(p) < q.error(best)) best = p;
+				}
+			}
+		}
+		// the area weights are divided out again, so the cost is a squared distance in m^2 that maxError can limit
+		double cost = q.weight > 0 ? std::max(q.error(best), 0.0) / q.weight : 0.0;
+		c = Collapse{cost, from, to, stamps[from], stamps[to], best};
+		return true;
+	}
+
+	/// Whether moving v to p flips or degenerates any face of v that survives the collapse of (from, to).
+	bool flips(size_t v, size_t from, size_t to, const cv::Vec3d &p) const {
+		for (size_t f : vertFaces[v]) {
+			if (!faceAlive[f]) continue;
+			auto &t = faces[f];
+			if (contains(t, from) && contains(t, to)) continue;
+			cv::Vec3d before[3], after[3];
+			for (int e = 0; e < 3; e++) {
+				before[e] = pos[t[e]];
+				after[e] = t[e] == v ? p : pos[t[e]];
+			}
+			cv::Vec3d n0 = (before[1] - before[0]).cross(before[2] - before[0]);
+			cv::Vec3d n1 = (after[1] - after[0]).cross(after[2] - after[0]);
+			if (n0.dot(n1) <= 0.1 * cv::norm(n0) * cv::norm(n1)) return true;
+		}
+		return false;
+	}
+
+	/// Returns the number of removed faces, 0 if the collapse is not allowed.
+	int collapse(const Collapse &c, const std::vector<char> &locked, std::vector<size_t> &scratchA,
+	             std::vector<size_t> &scratchB) {
+		// more than two common neighbours would pinch the surface into a non-manifold edge
+		neighbours(c.from, scratchA);
+		neighbours(c.to, scratchB);
+		size_t common = 0;
+		for (size_t w : scratchA) common += std::binary_search(scratchB.begin(), scratchB.end(), w);
+		if (common > 2) return 0;
+
+		if (flips(c.from, c.from, c.to, c.target) || flips(c.to, c.from, c.to, c.target)) return 0;
+
+		int removed = 0;
+		for (size_t f : vertFaces[c.from]) {
+			if (!faceAlive[f]) continue;
+			auto &t = faces[f];
+			if (contains(t, c.to)) {
+				faceAlive[f] = 0;
+				removed++;
+				continue;
+			}
+			for (auto &v : t) {
+				if (v == c.from) v = c.to;
+			}
+			vertFaces[c.to].push_back(f);
+		}
+		vertFaces[c.from].clear();
+		// drop the references to removed faces
+		auto &list = vertFaces[c.to];
+		list.erase(std::remove_if(list.begin(), list.end(), [&](size_t f) { return !faceAlive[f]; }), list.end());
+
+		// a locked vertex keeps its position (see plan), and the cluster across the border reads it concurrently
+		if (!locked[c.to]) pos[c.to] = c.target;
+		quadrics[c.to] += quadrics[c.from];
+		stamps[c.from]++;
+		stamps[c.to]++;
+		return removed;
+	}
+
+	/// Greedy collapses within one cluster until it has at most targetFaces faces or the next one costs too much.
+	size_t decimate(const std::vector<size_t> &verts, size_t clusterFaces, size_t targetFaces, double maxError,
+	                const std::vector<char> &locked) {
+		std::priority_queue<Collapse> heap;
+		std::vector<size_t> scratchA, scratchB;
+		Collapse c;
+
+		auto push = [&](size_t v) {
+			neighbours(v, scratchA);
+			for (size_t w : scratchA) {
+				if (plan(v, w, locked, c)) heap.push(c);
+			}
+		};
+		for (size_t v : verts) {
+			if (!locked[v]) push(v);
+		}
+
+		size_t removed = 0;
+		while (!heap.empty() && clusterFaces - removed > targetFaces) {
+			Collapse top = heap.top();
+			heap.pop();
+			if (top.fromStamp != stamps[top.from] || top.toStamp != stamps[top.to]) continue;
+			if (maxError > 0 && top.cost > maxError) break;
+
+			int faces = collapse(top, locked, scratchA, scratchB);
+			if (faces == 0) continue;
+			removed += faces;
+			push(top.to);
+		}
+		return removed;
+	}
+
+	/// One round over clusters of the bounding box split perAxis times along every axis, shifted by a fraction of
+	/// the cluster size. perAxis == 1 is a single serial cluster.
+	void round(int perAxis, double shift, double ratio, double maxError) {
+		cv::Vec3d lo = pos.front(), hi = pos.front();
+		for (auto &p : pos) {
+			for (int a = 0; a < 3; a++) {
+				lo[a] = std::min(lo[a], p[a]);
+				hi[a] = std::max(hi[a], p[a]);
+			}
+		}
+
+		std::vector<int> cluster(pos.size());
+		for (size_t v = 0; v < pos.size(); v++) {
+			int id = 0;
+			for (int a = 0; a < 3; a++) {
+				double size = (hi[a] - lo[a]) / perAxis + 1e-12;
+				int cell = static_cast<int>((pos[v][a] - lo[a]) / size + shift);
+				id = id * (perAxis + 1) + std::clamp(cell, 0, perAxis);
+			}
+			cluster[v] = id;
+		}
+
+		std::vector<char> locked = border;
+		int clusters = (perAxis + 1) * (perAxis + 1) * (perAxis + 1);
+		std::vector<std::vector<size_t>> members(clusters);
+		std::vector<size_t> clusterFaces(clusters, 0);
+		for (size_t f = 0; f < faces.size(); f++) {
+			if (!faceAlive[f]) continue;
+			auto &t = faces[f];
+			if (cluster[t[0]] == cluster[t[1]] && cluster[t[0]] == cluster[t[2]]) {
+				clusterFaces[cluster[t[0]]]++;
+			}
+			else {
+				for (size_t v : t) locked[v] = 1;
+			}
+		}
+		for (size_t v = 0; v < pos.size(); v++) {
+			if (!vertFaces[v].empty()) members[cluster[v]].push_back(v);
+		}
+
+		size_t removed = 0;
+		#pragma omp parallel for schedule(dynamic) reduction(+:removed)
+		for (int id = 0; id < clusters; id++) {
+			if (clusterFaces[id] == 0) continue;
+			auto target = static_cast<size_t>(std::ceil(clusterFaces[id] * ratio));
+			removed += decimate(members[id], clusterFaces[id], target, maxError, locked);
+		}
+		aliveFaces -= removed;
+	}
+};
+
+struct PositionHash {
+	size_t operator()(const std::array<float, 3> &p) const {
+		uint32_t bits[3];
+		std::memcpy(bits, p.data(), sizeof(bits));
+		return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+	}
+};
+
+}
+
+void Mesh::Decimate(const DecimateOptions &options) {
+	if (faces.empty() || (options.targetFaces == 0 && options.maxError <= 0)) return;
+
+	// marching cubes emits three vertices per face, neighbouring faces share bit identical positions
+	Decimator d;
+	std::unordered_map<std::array<float, 3>, size_t, PositionHash> welded;
+	std::vector<size_t> remap(verts.size());
+	bool vertexColors = vertsColor.size() == verts.size();
+	std::vector<RGB> colors;
+	for (size_t v = 0; v < verts.size(); v++) {
+		auto [it, inserted] = welded.try_emplace({verts[v].x, verts[v].y, verts[v].z}, d.pos.size());
+		if (inserted) {
+			d.pos.emplace_back(verts[v].x, verts[v].y, verts[v].z);
+			if (vertexColors) colors.push_back(vertsColor[v]);
+		}
+		remap[v] = it->second;
+	}
+	for (auto &f : faces) {
+		d.faces.push_back({remap[f.v1], remap[f.v2], remap[f.v3]});
+	}
+	d.build();
+
+	// every cluster keeps the same share of its faces, without a target only the error limits the collapses
+	size_t target = options.targetFaces;
+	double maxError = options.maxError * options.maxError;
+	auto ratio = [&]() { return target ? std::min(1.0, static_cast<double>(target) / d.aliveFaces) : 0.0; };
+
+	d.round(8, 0.0, ratio(), maxError);
+	if (d.aliveFaces > target) d.round(8, 0.5, ratio(), maxError);
+	if (d.aliveFaces > target) d.round(1, 0.0, ratio(), maxError);
+
+	// compact, keeping the order of the remaining faces
+	std::vector<size_t> index(d.pos.size(), SIZE_MAX);
+	std::vector<vertex> newVerts;
+	std::vector<RGB> newVertColors;
+	std::vector<triangle> newFaces;
+	std::vector<RGB> newFaceColors;
+	for (size_t f = 0; f < d.faces.size(); f++) {
+		if (!d.faceAlive[f]) continue;
+		size_t ids[3];
+		for (int e = 0; e < 3; e++) {
+			size_t v = d.faces[f][e];
+			if (index[v] == SIZE_MAX) {
+				index[v] = newVerts.size();
+				newVerts.push_back(vertex{static_cast<float>(d.pos[v][0]), static_cast<float>(d.pos[v][1]),
+				                          static_cast<float>(d.pos[v][2])});
+				if (vertexColors) newVertColors.push_back(colors[v]);
+			}
+			ids[e] = index[v];
+		}
+		newFaces.push_back(triangle{ids[0], ids[1], ids[2]});
+		if (f < facesColor.size()) newFaceColors.push_back(facesColor[f]);
+	}
+	verts = std::move(newVerts);
+	faces = std::move(newFaces);
+	facesColor = std::move(newFaceColors);
+	vertsColor = std::move(newVertColors);
+}
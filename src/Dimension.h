@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/// Order of the voxels in Grid::voxels and Grid::voxelsColor.
+enum class VoxelLayout {
+	/// k fastest, then j, then i
+	Linear,
+	/// Bricks of 4^3 voxels (one occupancy word) along a Z-curve, voxels within a brick ordered like Linear. The
+	/// neighbours of a voxel are mostly in the same word and cache line. Only for full grids of the dimensions
+	/// DispatchDimension specializes.
+	Morton,
+};
+
+/// Spreads the lower 10 bits of v to every third bit.
+constexpr size_t SpreadBits3(size_t v) {
+	v &= 0x3FF;
+	v = (v | v << 16) & 0x030000FF;
+	v = (v | v << 8) & 0x0300F00F;
+	v = (v | v << 4) & 0x030C30C3;
+	v = (v | v << 2) & 0x09249249;
+	return v;
+}
+
+/// Position of voxel (i, j, k) in VoxelLayout::Morton.
+constexpr size_t MortonIndex(int i, int j, int k) {
+	size_t brick = SpreadBits3(i >> 2) << 2 | SpreadBits3(j >> 2) << 1 | SpreadBits3(k >> 2);
+	return brick << 6 | static_cast<size_t>(i & 3) << 4 | static_cast<size_t>(j & 3) << 2 | static_cast<size_t>(k & 3);
+}
+
+/// Grid dimension known at compile time. Kernels templated on it index voxels with shifts, and every row of voxels
+/// (fixed i and j) is made of whole words of Grid::voxels.
+template<int D>
+struct FixedDimension {
+	static_assert(D >= 64 && (D & (D - 1)) == 0, "fixed dimensions are powers of two of at least one voxel word");
+
+	static constexpr int shift = D == 64 ? 6 : D == 128 ? 7 : D == 256 ? 8 : D == 512 ? 9 : D == 1024 ? 10 : -1;
+	static_assert(shift > 0, "no shift for this dimension");
+
+	static constexpr bool wholeWords = true;
+	static constexpr bool bricks = false;
+
+	constexpr int value() const { return D; }
+
+	/// Same as Grid::index, with i counted from the beginning of the slab.
+	constexpr size_t index(int i, int j, int k) const {
+		return static_cast<size_t>(k) | static_cast<size_t>(j) << shift | static_cast<size_t>(i) << (2 * shift);
+	}
+};
+
+/// FixedDimension in VoxelLayout::Morton. The voxels of a row (fixed i and j) are D / 4 runs of four bits, one per
+/// brick the row crosses.
+template<int D>
+struct MortonDimension {
+	static_assert(D >= 64 && (D & (D - 1)) == 0 && D <= 1024, "Morton grids are powers of two of 64 to 1024");
+
+	static constexpr bool wholeWords = false;
+	static constexpr bool bricks = true;
+
+	// MortonIndex is the sum of independent parts of i, j and k, looked up instead of interleaving bits every time
+	static constexpr std::array<uint32_t, D> parts(int axis) {
+		std::array<uint32_t, D> part{};
+		for (int v = 0; v < D; v++) {
+			part[v] = static_cast<uint32_t>(MortonIndex(axis == 0 ? v : 0, axis == 1 ? v : 0, axis == 2 ? v : 0));
+		}
+		return part;
+	}
+	static constexpr std::array<uint32_t, D> partI = parts(0), partJ = parts(1), partK = parts(2);
+
+	constexpr int value() const { return D; }
+
+	constexpr size_t index(int i, int j, int k) const { return size_t(partI[i]) | partJ[j] | partK[k]; }
+};
+
+/// Any other dimension, the generic fallback of DispatchDimension.
+struct RuntimeDimension {
+	int dimension;
+
+	static constexpr bool wholeWords = false;
+	static constexpr bool bricks = false;
+
+	int value() const { return dimension; }
+
+	size_t index(int i, int j, int k) const {
+		return k + static_cast<size_t>(dimension) * (j + static_cast<size_t>(i) * dimension);
+	}
+};
+
+/// Calls kernel with the FixedDimension (or MortonDimension) of the resolutions we usually run at, RuntimeDimension
+/// otherwise.
+template<typename Kernel>
+decltype(auto) DispatchDimension(int dimension, VoxelLayout layout, Kernel &&kernel) {
+	if (layout == VoxelLayout::Morton) {
+		switch (dimension) {
+		case 64: return kernel(MortonDimension<64>());
+		case 128: return kernel(MortonDimension<128>());
+		case 256: return kernel(MortonDimension<256>());
+		case 512: return kernel(MortonDimension<512>());
+		default: break;
+		}
+	}
+	switch (dimension) {
+	case 64: return kernel(FixedDimension<64>());
+	case 128: return kernel(FixedDimension<128>());
+	case 256: return kernel(FixedDimension<256>());
+	case 512: return kernel(FixedDimension<512>());
+	default: return kernel(RuntimeDimension{dimension});
+	}
+}
+
+/// Whether DispatchDimension has a MortonDimension for this dimension.
+constexpr bool SupportsMorton(int dimension) {
+	return dimension == 64 || dimension == 128 || dimension == 256 || dimension == 512;
+}
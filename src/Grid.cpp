@@ -1,24 +1,309 @@
 #include "Grid.h"
+#include "Dimension.h"
+#include "ImageSource.h"
 #include "Trace.h"
 #include "Mesh.h"
+#include <algorithm>
+#include <bitset>
+#include <cmath>
 #include <iostream>
 #include <fstream>
+#include <limits>
 #include <string>
 #include <fstream>
 #include <opencv2/opencv.hpp>
 
 using namespace cv;
 
+VoxelBits::VoxelBits(size_t size, bool value) : words((size + 63) / 64, value ? ~uint64_t(0) : 0), bits(size) {
+	// bits past the end stay zero, so whole words can be counted
+	if (value && (size & 63)) words.back() = (uint64_t(1) << (size & 63)) - 1;
+}
+
+size_t VoxelBits::clear_range(size_t begin, size_t end) {
+	if (begin >= end) return 0;
+	size_t first = begin >> 6, last = (end - 1) >> 6;
+	uint64_t keepFirst = ~(~uint64_t(0) << (begin & 63));
+	uint64_t keepLast = (end & 63) ? ~uint64_t(0) << (end & 63) : 0;
+	// the bits a word had before, counted from the value the atomic operation replaced. Other threads may clear or
+	// read any of the words at the same time, also the ones in between (e.g. other views carving the same row).
+	auto clearWord = [&](size_t w, uint64_t keep) {
+		uint64_t old;
+		#pragma omp atomic capture
+		{ old = words[w]; words[w] &= keep; }
+		return static_cast<size_t>(std::bitset<64>(old & ~keep).count());
+	};
+	if (first == last) return clearWord(first, keepFirst | keepLast);
+
+	size_t cleared = clearWord(first, keepFirst);
+	for (size_t w = first + 1; w < last; w++) cleared += clearWord(w, 0);
+	return cleared + clearWord(last, keepLast);
+}
+
+size_t VoxelBits::count() const {
+	size_t n = 0;
+	for (uint64_t word : words) n += std::bitset<64>(word).count();
+	return n;
+}
+
+// image is in BGR notation
+static uint32_t PackColor(const Vec3b &bgr) {
+	return bgr.val[2] | (bgr.val[1] << 8) | (bgr.val[0] << 16);
+}
+
+// Calls f(k, idx) for every voxel of row (i, j) that is still set. The rows of a FixedDimension are whole words,
+// which are read at once so that carved runs cost one test per 64 voxels.
+template<typename Dim, typename F>
+static void ForEachOccupied(const Grid &g, Dim d, int i, int j, F &&f) {
+	size_t row = d.index(i - g.slabBegin, j, 0);
+	if constexpr (Dim::wholeWords) {
+		for (int w = 0; w < d.value() / 64; w++) {
+			uint64_t word = g.voxels.word_atomic(row + 64 * w);
+			while (word) {
+				int bit = __builtin_ctzll(word);
+				f(64 * w + bit, row + 64 * w + bit);
+				word &= word - 1;
+			}
+		}
+	}
+	else if constexpr (Dim::bricks) {
+		// four voxels of the row per brick, their bits are next to each other
+		for (int k = 0; k < d.value(); k += 4) {
+			size_t first = d.index(i - g.slabBegin, j, k);
+			uint64_t run = (g.voxels.word_atomic(first) >> (first & 63)) & 0xFu;
+			while (run) {
+				int bit = __builtin_ctzll(run);
+				f(k + bit, first + bit);
+				run &= run - 1;
+			}
+		}
+	}
+	else {
+		for (int k = 0; k < d.value(); k++) {
+			if ((g.voxels.word_atomic(row + k) >> ((row + k) & 63)) & 1u) f(k, row + k);
+		}
+	}
+}
+
+// Clears the voxels kBegin <= k < kEnd of row (i, j), from any thread. Returns how many of them were occupied.
+static size_t ClearRow(Grid &g, int i, int j, int kBegin, int kEnd) {
+	if (g.layout == VoxelLayout::Linear) {
+		size_t cleared = g.voxels.clear_range(g.index(i, j, kBegin), g.index(i, j, 0) + kEnd);
+		// the whole range counts as changed, one mark per brick
+		if (cleared) {
+			for (int k = kBegin; k < kEnd; k += Grid::brickSize - k % Grid::brickSize) g.MarkChanged(i, j, k);
+		}
+		return cleared;
+	}
+	size_t cleared = 0;
+	for (int k = kBegin; k < kEnd; k++) {
+		cleared += g.ClearVoxel(g.index(i, j, k), i, j, k);
+	}
+	return cleared;
+}
+
+// A view prepared for carving by lines: the mask without lens distortion and the pinhole projection onto its pixels.
+struct LineView {
+	cv::Mat mask;
+	const uchar *pixels;
+	size_t step;
+	int width, height;
+	/// homogeneous mask coordinates of a point p: projection * p + offset
+	cv::Matx33d projection;
+	cv::Vec3d offset;
+	/// the image without lens distortion and the projection onto its pixels, only for the view that colors the voxels
+	cv::Mat image;
+	cv::Matx33d imageProjection;
+	cv::Vec3d imageOffset;
+};
+
+static LineView PrepareLineView(const Grid::View &view, bool color) {
+	LineView line;
+	// intrinsics of the mask resolution, the same as scaling the projected points
+	cv::Mat camera = ScaleCameraMatrix(view.cameraMatrix, static_cast<double>(view.mask.cols) / view.image.cols,
+	                                   static_cast<double>(view.mask.rows) / view.image.rows);
+	// undistorting the mask once lets every row of voxels project to a straight line
+	if (!view.distCoeffs.empty() && cv::countNonZero(view.distCoeffs) > 0) {
+		cv::Mat map1, map2;
+		cv::initUndistortRectifyMap(camera, view.distCoeffs, cv::Mat(), camera, view.mask.size(), CV_16SC2, map1, map2);
+		cv::remap(view.mask, line.mask, map1, map2, cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0));
+	}
+	else {
+		line.mask = view.mask;
+	}
+	line.pixels = line.mask.data;
+	line.step = line.mask.step;
+	line.width = line.mask.cols;
+	line.height = line.mask.rows;
+
+	cv::Matx33d rotation;
+	cv::Rodrigues(view.rotation, rotation);
+	cv::Matx33d intrinsics = camera;
+	line.projection = intrinsics * rotation;
+	line.offset = intrinsics * view.translation;
+
+	if (color) {
+		if (!view.distCoeffs.empty() && cv::countNonZero(view.distCoeffs) > 0) {
+			cv::Mat map1, map2;
+			cv::initUndistortRectifyMap(view.cameraMatrix, view.distCoeffs, cv::Mat(), view.cameraMatrix, view.image.size(),
+			                            CV_16SC2, map1, map2);
+			cv::remap(view.image, line.image, map1, map2, cv::INTER_NEAREST);
+		}
+		else {
+			line.image = view.image;
+		}
+		cv::Matx33d imageIntrinsics = view.cameraMatrix;
+		line.imageProjection = imageIntrinsics * rotation;
+		line.imageOffset = imageIntrinsics * view.translation;
+	}
+	return line;
+}
+
+// Clears the voxels of row (i, j) that project onto the background of the view or outside of it. first is the center
+// of voxel k = 0 and step the offset to the next one. The row is a straight line in the image: the pixels along it are
+// visited in order, each decides the run of voxels whose centers fall onto it, so the work depends on the projected
+// length of the row instead of the number of voxels. When the view has an image, the occupied voxels on the silhouette
+// take their color from it on the way. Returns the number of voxels cleared.
+static size_t CarveRowLine(Grid &g, const LineView &view, int i, int j, cv::Vec3d first, cv::Vec3d step) {
+	int dim = g.dimension;
+	// homogeneous mask coordinates of the first voxel center and of the step to the next one
+	cv::Vec3d h0 = view.projection * first + view.offset;
+	cv::Vec3d hd = view.projection * step;
+	const double inf = std::numeric_limits<double>::infinity();
+
+	// Voxel t is in front of the camera and inside the mask where a few linear functions of t are positive, which
+	// leaves one interval of t.
+	double lo = 0, hi = dim - 1;
+	auto keep = [&](double a, double b) {
+		// a + b * t >= 0
+		if (b == 0) {
+			if (a < 0) hi = -1;
+		}
+		else if (b > 0) {
+			lo = std::max(lo, -a / b);
+		}
+		else {
+			hi = std::min(hi, -a / b);
+		}
+	};
+	keep(h0[2] - 1e-9, hd[2]);
+	keep(h0[0], hd[0]);
+	keep(view.width * h0[2] - h0[0], view.width * hd[2] - hd[0]);
+	keep(h0[1], hd[1]);
+	keep(view.height * h0[2] - h0[1], view.height * hd[2] - hd[1]);
+	int kBegin = static_cast<int>(std::ceil(std::min(lo, double(dim))));
+	int kEnd = hi < lo ? kBegin : static_cast<int>(std::floor(hi)) + 1;
+	if (kBegin >= kEnd) return ClearRow(g, i, j, 0, dim);
+	size_t cleared = ClearRow(g, i, j, 0, kBegin) + ClearRow(g, i, j, kEnd, dim);
+
+	auto u = [&](double t) { return (h0[0] + t * hd[0]) / (h0[2] + t * hd[2]); };
+	auto v = [&](double t) { return (h0[1] + t * hd[1]) / (h0[2] + t * hd[2]); };
+	// t at which the row reaches column (axis 0) or line (axis 1) c of the mask. Solutions before lo are behind the
+	// camera, the row approaches c asymptotically without reaching it.
+	auto crossing = [&](int axis, int c) {
+		double denominator = hd[axis] - c * hd[2];
+		double t = denominator == 0 ? inf : (c * h0[2] - h0[axis]) / denominator;
+		return t < lo ? inf : t;
+	};
+	int pu = std::clamp(static_cast<int>(std::floor(u(kBegin))), 0, view.width - 1);
+	int pv = std::clamp(static_cast<int>(std::floor(v(kBegin))), 0, view.height - 1);
+	// u and v are monotonic along the row, with the sign of their derivative
+	double du = hd[0] * h0[2] - h0[0] * hd[2];
+	double dv = hd[1] * h0[2] - h0[1] * hd[2];
+	int su = du > 0 ? 1 : du < 0 ? -1 : 0;
+	int sv = dv > 0 ? 1 : dv < 0 ? -1 : 0;
+	auto nextU = [&]() { return su == 0 ? inf : crossing(0, su > 0 ? pu + 1 : pu); };
+	auto nextV = [&]() { return sv == 0 ? inf : crossing(1, sv > 0 ? pv + 1 : pv); };
+	double tu = nextU(), tv = nextV();
+
+	// colors the voxels kFrom <= t < kTo that are still set, they lie in front of the camera
+	auto paint = [&](int kFrom, int kTo) {
+		if (view.image.empty()) return;
+		cv::Vec3d c0 = view.imageProjection * first + view.imageOffset;
+		cv::Vec3d cd = view.imageProjection * step;
+		for (int t = kFrom; t < kTo; t++) {
+			size_t idx = g.index(i, j, t);
+			if (!((g.voxels.word_atomic(idx) >> (idx & 63)) & 1u)) continue;
+			cv::Vec3d c = c0 + t * cd;
+			int xs = c[0] / c[2];
+			int ys = c[1] / c[2];
+			if (xs < 0 || ys < 0 || xs >= view.image.cols || ys >= view.image.rows) continue;
+			g.voxelsColor[idx] = PackColor(view.image.at<Vec3b>(ys, xs));
+		}
+	};
+
+	int k = kBegin;
+	// first voxel of the background run that is not cleared yet, -1 without one
+	int run = -1;
+	while (k < kEnd) {
+		// the voxels k <= t < next lie on pixel (pu, pv)
+		double next = std::min(tu, tv);
+		int kNext = next >= kEnd ? kEnd : std::max(k, static_cast<int>(std::ceil(next)));
+		if (kNext > k) {
+			if (view.pixels[pv * view.step + pu] == 0) {
+				if (run < 0) run = k;
+			}
+			else {
+				if (run >= 0) {
+					cleared += ClearRow(g, i, j, run, k);
+					run = -1;
+				}
+				paint(k, kNext);
+			}
+			k = kNext;
+		}
+		if (tu <= tv) {
+			pu += su;
+			tu = nextU();
+			// rounding at the border of the mask, the rest of the row stays on the last pixel
+			if (pu < 0 || pu >= view.width) {
+				pu = std::clamp(pu, 0, view.width - 1);
+				su = 0;
+				tu = inf;
+			}
+		}
+		else {
+			pv += sv;
+			tv = nextV();
+			if (pv < 0 || pv >= view.height) {
+				pv = std::clamp(pv, 0, view.height - 1);
+				sv = 0;
+				tv = inf;
+			}
+		}
+	}
+	if (run >= 0) cleared += ClearRow(g, i, j, run, kEnd);
+	return cleared;
+}
+
 // fill list of voxels, set values that are determined by measuring the object (in meters)
 // (0,0,0) is the middle of the marker
-Grid::Grid(int dim, float x, float y, float z) {
+Grid::Grid(int dim, float x, float y, float z) : Grid(dim, x, y, z, 0, dim) {}
+
+Grid::Grid(int dim, float x, float y, float z, VoxelLayout layout) : Grid(dim, x, y, z, 0, dim) {
+	if (layout == VoxelLayout::Morton && SupportsMorton(dim)) this->layout = layout;
+}
+
+Grid::Grid(int dim, float x, float y, float z, cv::Vec3f center, VoxelLayout layout) : Grid(dim, x, y, z, layout) {
+	this->center = center;
+}
+
+Grid::Grid(int dim, float x, float y, float z, int slabBegin, int slabEnd) {
 	this->dimension = dim;
 	this->x_length = x;
 	this->y_length = y;
 	this->z_length = z;
+	this->slabBegin = slabBegin;
+	this->slabEnd = slabEnd;
+
+	size_t size = static_cast<size_t>(slabEnd - slabBegin) * dim * dim;
+	voxels = VoxelBits(size, true);
+	voxelsColor.resize(size, 0xFFFFFFFFU );
+}
 
-	voxels.resize(dim * dim * dim, true);
-	voxelsColor.resize(dim * dim * dim, 0xFFFFFFFFU );
+void Grid::TrackChanges() {
+	size_t n = BrickCount();
+	changedBricks.assign(n * n * n, 1);
 }
 
 // there are a lot of duplicate vertices in there, might want to optimize this
@@ -34,16 +319,135 @@ bool Grid::WriteMesh(const std::string &filename) {
 }
 
 bool Grid::WriteMeshColor(const std::string& filename) {
+	return WriteMeshColor(filename, DecimateOptions());
+}
+
+bool Grid::WriteMeshColor(const std::string& filename, const DecimateOptions &decimate) {
 	std::ofstream outFile(filename);
 	if (!outFile.is_open()) return false;
 
+	// without decimation the mesh never has to be in memory
+	if (decimate.targetFaces == 0 && decimate.maxError <= 0) {
+		return WriteOffColorStreaming(*this, outFile);
+	}
+
 	Mesh m;
 	MarchingCubes(*this, m);
+	m.Decimate(decimate);
 	m.WriteOffColor(outFile);
 
 	return true;
 }
 
+bool Grid::Save(std::ostream &out) const {
+	int32_t dim = dimension;
+	float lengths[3] = {x_length, y_length, z_length};
+	out.write(reinterpret_cast<const char *>(&dim), sizeof(dim));
+	out.write(reinterpret_cast<const char *>(lengths), sizeof(lengths));
+	out.write(reinterpret_cast<const char *>(center.val), sizeof(center.val));
+
+	// byte wise, so the file does not depend on the endianness
+	std::vector<uint8_t> packed((voxels.size() + 7) / 8);
+	if (layout == VoxelLayout::Linear) {
+		for (size_t b = 0; b < packed.size(); b++) {
+			packed[b] = voxels.byte(b);
+		}
+		out.write(reinterpret_cast<const char *>(packed.data()), packed.size());
+		out.write(reinterpret_cast<const char *>(voxelsColor.data()), voxelsColor.size() * sizeof(uint32_t));
+		return out.good();
+	}
+
+	// other layouts are reordered, so a checkpoint can be resumed with any layout
+	size_t n = 0;
+	for (int i = slabBegin; i < slabEnd; i++) {
+		for (int j = 0; j < dimension; j++) {
+			for (int k = 0; k < dimension; k++, n++) {
+				if (voxels[index(i, j, k)]) packed[n >> 3] |= uint8_t(1) << (n & 7);
+			}
+		}
+	}
+	out.write(reinterpret_cast<const char *>(packed.data()), packed.size());
+	std::vector<uint32_t> colors(static_cast<size_t>(dimension) * dimension);
+	for (int i = slabBegin; i < slabEnd; i++) {
+		for (int j = 0; j < dimension; j++) {
+			for (int k = 0; k < dimension; k++) {
+				colors[static_cast<size_t>(j) * dimension + k] = voxelsColor[index(i, j, k)];
+			}
+		}
+		out.write(reinterpret_cast<const char *>(colors.data()), colors.size() * sizeof(uint32_t));
+	}
+	return out.good();
+}
+
+bool Grid::Load(std::istream &in) {
+	int32_t dim;
+	float lengths[3];
+	cv::Vec3f box;
+	in.read(reinterpret_cast<char *>(&dim), sizeof(dim));
+	in.read(reinterpret_cast<char *>(lengths), sizeof(lengths));
+	in.read(reinterpret_cast<char *>(box.val), sizeof(box.val));
+	if (!in || dim != dimension)
+		return false;
+	// a fitted grid only knows its box after the first frames, resuming takes it from the file
+	x_length = lengths[0];
+	y_length = lengths[1];
+	z_length = lengths[2];
+	center = box;
+	std::fill(changedBricks.begin(), changedBricks.end(), 1);
+
+	std::vector<uint8_t> packed((voxels.size() + 7) / 8);
+	if (layout == VoxelLayout::Linear) {
+		std::vector<uint32_t> colors(voxelsColor.size());
+		in.read(reinterpret_cast<char *>(packed.data()), packed.size());
+		in.read(reinterpret_cast<char *>(colors.data()), colors.size() * sizeof(uint32_t));
+		if (!in) return false;
+
+		for (size_t b = 0; b < packed.size(); b++) {
+			voxels.set_byte(b, packed[b]);
+		}
+		voxelsColor = std::move(colors);
+		return true;
+	}
+
+	// the file is in Linear order (see Save)
+	if (!in.read(reinterpret_cast<char *>(packed.data()), packed.size())) return false;
+	std::vector<uint32_t> colors(static_cast<size_t>(dimension) * dimension);
+	std::vector<uint32_t> loaded(voxelsColor.size());
+	for (int i = slabBegin; i < slabEnd; i++) {
+		if (!in.read(reinterpret_cast<char *>(colors.data()), colors.size() * sizeof(uint32_t))) return false;
+		for (int j = 0; j < dimension; j++) {
+			for (int k = 0; k < dimension; k++) {
+				loaded[index(i, j, k)] = colors[static_cast<size_t>(j) * dimension + k];
+			}
+		}
+	}
+	size_t n = 0;
+	for (int i = slabBegin; i < slabEnd; i++) {
+		for (int j = 0; j < dimension; j++) {
+			for (int k = 0; k < dimension; k++, n++) {
+				voxels.set(index(i, j, k), (packed[n >> 3] >> (n & 7)) & 1u);
+			}
+		}
+	}
+	voxelsColor = std::move(loaded);
+	return true;
+}
+
+int Grid::MaskLevel(const cv::Mat &cam, cv::Vec3d t, double pixelsPerVoxel, int maxLevel) const {
+	double voxelSize = std::min({x_length, y_length, z_length}) / dimension;
+	// the nearest voxels have the largest projection. t is the origin, which a fitted grid is not centered on.
+	double radius = 0.5 * std::sqrt(x_length * x_length + y_length * y_length + z_length * z_length) + cv::norm(center);
+	double depth = std::max(cv::norm(t) - radius, 1e-3);
+	double focal = std::max(cam.at<double>(0, 0), cam.at<double>(1, 1));
+	double projected = focal * voxelSize / depth;
+
+	int level = 0;
+	while (level < maxLevel && projected / (2 << level) >= pixelsPerVoxel) {
+		level++;
+	}
+	return level;
+}
+
 void Grid::Carve(cv::Vec3d t, cv::Vec3d r, cv::Mat mask, cv::Mat cam) {
 	// get extrinsic camera matrix.
 	// rot + t describes the marker relative to the camera, we want the inverse, so invert the matrix.
@@ -76,65 +480,99 @@ void Grid::Carve(cv::Vec3d t, cv::Vec3d r, cv::Mat mask, cv::Mat cam) {
 	auto n_right = c10.cross(c11);
 	auto n_top = c00.cross(c10);
 	auto n_bottom = c11.cross(c01);
-	CarveClipPlane(n_left, orig.dot(n_left));
-	CarveClipPlane(n_right, orig.dot(n_right));
-	CarveClipPlane(n_top, orig.dot(n_top));
-	CarveClipPlane(n_bottom, orig.dot(n_bottom));
+	CarveClipPlanes({
+		ClipPlane{n_left, orig.dot(n_left)},
+		ClipPlane{n_right, orig.dot(n_right)},
+		ClipPlane{n_top, orig.dot(n_top)},
+		ClipPlane{n_bottom, orig.dot(n_bottom)},
+	});
 }
 
 void Grid::CarveClipPlane(cv::Vec3d n, double orig) {
+	CarveClipPlanes({ClipPlane{n, orig}});
+}
+
+void Grid::CarveClipPlanes(const std::vector<ClipPlane> &planes) {
 	double voxelWidth = x_length / dimension;
 	double voxelHeight = y_length / dimension;
 	double voxelDepth = z_length / dimension;
 
-	double startX = -x_length / 2;
-	double startY = -y_length / 2;
-	double startZ = -z_length / 2;
+	double startX = center[0] - x_length / 2;
+	double startY = center[1] - y_length / 2;
+	double startZ = center[2] - z_length / 2;
 
+	// center decides whether inside or outside.
+	auto inside = [&](const ClipPlane &plane, double x, double y, int k) {
+		cv::Vec3d center(x, y, startZ + (k + 0.5) * voxelDepth);
+		return plane.normal.dot(center) >= plane.orig;
+	};
 
-	auto it = voxels.begin();
-
-	// FIXME: this is a slow algorithm. Faster ones exist.
-
-	for (int i = 0; i < dimension; i++) {
-		// center decides whether inside or outside.
+	// Along a row (fixed i and j) the distance to a plane is monotonic in k, so the voxels inside all planes are one
+	// interval of k. Its ends are computed in closed form and corrected with the per voxel test, which decides voxels
+	// on the plane exactly as before.
+	#pragma omp parallel for schedule(dynamic, 2)
+	for (int i = slabBegin; i < slabEnd; i++) {
 		auto x = startX + (i + 0.5) * voxelWidth;
 		for (int j = 0; j < dimension; j++) {
 			auto y = startY + (j + 0.5) * voxelHeight;
-			for (int k = 0; k < dimension; k++, it++) {
-				auto z = startZ + (k + 0.5) * voxelDepth;
-
-				cv::Vec3d center(x, y, z);
-				auto dist = n.dot(center);
-				if (dist < orig) {
-					*it = false;
+			int kBegin = 0, kEnd = dimension;
+			for (auto &plane : planes) {
+				if (kBegin >= kEnd) break;
+				// distance of voxel k: a + b * k
+				double a = plane.normal[0] * x + plane.normal[1] * y + plane.normal[2] * (startZ + 0.5 * voxelDepth);
+				double b = plane.normal[2] * voxelDepth;
+				double boundary = (plane.orig - a) / b;
+				if (b == 0 || !std::isfinite(boundary)) {
+					// parallel to the row, all voxels are on the same side
+					if (!inside(plane, x, y, kBegin)) kEnd = kBegin;
+				}
+				else if (b > 0) {
+					// inside from the boundary on
+					int k = static_cast<int>(std::clamp(std::ceil(boundary), double(kBegin), double(kEnd)));
+					while (k > kBegin && inside(plane, x, y, k - 1)) k--;
+					while (k < kEnd && !inside(plane, x, y, k)) k++;
+					kBegin = k;
+				}
+				else {
+					// inside up to the boundary
+					int k = static_cast<int>(std::clamp(std::floor(boundary) + 1, double(kBegin), double(kEnd)));
+					while (k < kEnd && inside(plane, x, y, k)) k++;
+					while (k > kBegin && !inside(plane, x, y, k - 1)) k--;
+					kEnd = k;
 				}
 			}
+			if (kBegin >= kEnd) {
+				ClearRow(*this, i, j, 0, dimension);
+				continue;
+			}
+			ClearRow(*this, i, j, 0, kBegin);
+			ClearRow(*this, i, j, kEnd, dimension);
 		}
 	}
 }
 
 
 
+
 void Grid::CarveMask(InputArray tvec, InputArray rvec, Mat mask, InputArray cameraMatrix, InputArray distCoeffs) {
 	double voxelWidth = x_length / dimension;
 	double voxelHeight = y_length / dimension;
 	double voxelDepth = z_length / dimension;
 
-	double startX = -x_length / 2;
-	double startY = -y_length / 2;
-	double startZ = -z_length / 2;
+	double startX = center[0] - x_length / 2;
+	double startY = center[1] - y_length / 2;
+	double startZ = center[2] - z_length / 2;
 
 	//std::cout << "mask size: " << mask.size() << std::endl;
-	auto it = voxels.begin();
 
-	for (int i = 0; i < dimension; i++) {
+	for (int i = slabBegin; i < slabEnd; i++) {
 		// center decides whether inside or outside.
 		auto x = startX + (i + 0.5) * voxelWidth;
 		for (int j = 0; j < dimension; j++) {
 			auto y = startY + (j + 0.5) * voxelHeight;
-			for (int k = 0; k < dimension; k++, it++) {
-				if (!*it) continue;
+			for (int k = 0; k < dimension; k++) {
+				size_t idx = index(i, j, k);
+				if (!voxels[idx]) continue;
 				auto z = startZ + (k + 0.5) * voxelDepth;
 
 				// project voxel centers into image
@@ -149,8 +587,10 @@ void Grid::CarveMask(InputArray tvec, InputArray rvec, Mat mask, InputArray came
 					continue;
 
 				// compare corresponding pixel to mask
-				if (mask.at<unsigned char>(ys, xs) == 0)
-					*it = false;
+				if (mask.at<unsigned char>(ys, xs) == 0) {
+					voxels.set(idx, false);
+					MarkChanged(i, j, k);
+				}
 					
 					
 			}
@@ -158,53 +598,180 @@ void Grid::CarveMask(InputArray tvec, InputArray rvec, Mat mask, InputArray came
 	}
 }
 
-void Grid::CarveMaskColor(InputArray tvec, InputArray rvec, Mat mask, InputArray cameraMatrix, InputArray distCoeffs, Mat image) {
+size_t Grid::CarveMaskColor(InputArray tvec, InputArray rvec, Mat mask, InputArray cameraMatrix, InputArray distCoeffs, Mat image) {
 	double voxelWidth = x_length / dimension;
 	double voxelHeight = y_length / dimension;
 	double voxelDepth = z_length / dimension;
 
-	double startX = -x_length / 2;
-	double startY = -y_length / 2;
-	double startZ = -z_length / 2;
-
-	// TODO: Test different scheduling methods
-	#pragma omp parallel for schedule(dynamic, 2)
-	for (int i = 0; i < dimension; i++) {
-		// center decides whether inside or outside.
-		auto x = startX + (i + 0.5) * voxelWidth;
-		for (int j = 0; j < dimension; j++) {
-			auto y = startY + (j + 0.5) * voxelHeight;
-			for (int k = 0; k < dimension; k++) {
-				auto voxel = voxels[k + dimension * (j + i * dimension)];
+	double startX = center[0] - x_length / 2;
+	double startY = center[1] - y_length / 2;
+	double startZ = center[2] - z_length / 2;
+
+	// the mask may be computed on a lower pyramid level than the image. Scaling the projected points is the same as
+	// projecting with intrinsics scaled to the mask resolution (see ScaleCameraMatrix).
+	double maskScaleX = static_cast<double>(mask.cols) / image.cols;
+	double maskScaleY = static_cast<double>(mask.rows) / image.rows;
+
+	size_t removed = 0;
+	DispatchDimension(dimension, layout, [&](auto d) {
+		// TODO: Test different scheduling methods
+		#pragma omp parallel
+		{
+			// the voxel centers of a row are projected at once, into buffers every thread reuses for all its rows
+			std::vector<Point3f> row;
+			std::vector<size_t> rowIdx;
+			std::vector<int> rowK;
+			std::vector<Point2f> projected;
+			// slabs of neighbouring i can share a word when dimension is not a multiple of 8, so the threads clear
+			// voxels atomically (see ClearVoxel)
+			#pragma omp for schedule(dynamic, 2) reduction(+:removed)
+			for (int i = slabBegin; i < slabEnd; i++) {
+				// center decides whether inside or outside.
+				auto x = startX + (i + 0.5) * voxelWidth;
+				for (int j = 0; j < d.value(); j++) {
+					auto y = startY + (j + 0.5) * voxelHeight;
+					row.clear();
+					rowIdx.clear();
+					rowK.clear();
+					ForEachOccupied(*this, d, i, j, [&](int k, size_t idx) {
+						row.emplace_back(x, y, startZ + (k + 0.5) * voxelDepth);
+						rowIdx.push_back(idx);
+						rowK.push_back(k);
+					});
+					if (row.empty()) continue;
+
+					// project voxel centers into image
+					projectPoints(row, rvec, tvec, cameraMatrix, distCoeffs, projected);
+					for (size_t v = 0; v < row.size(); v++) {
+						size_t idx = rowIdx[v];
+						int xs = projected[v].x;
+						int ys = projected[v].y;
+						if (xs < 0 || ys < 0 || xs >= image.cols || ys >= image.rows) {
+							removed += ClearVoxel(idx, i, j, rowK[v]);
+							continue;
+						}
+						// compare corresponding pixel to mask
+						int xm = projected[v].x * maskScaleX;
+						int ym = projected[v].y * maskScaleY;
+						if (mask.at<unsigned char>(ym, xm) == 0) {
+							removed += ClearVoxel(idx, i, j, rowK[v]);
+						}
+
+						voxelsColor[idx] = PackColor(image.at<Vec3b>(ys, xs));
+					}
+				}
+			}
+		}
+	});
+	return removed;
+}
 
-				if (!voxel) continue;
+size_t Grid::CarveViews(const std::vector<View> &views, bool rasterize) {
+	if (views.empty()) return 0;
 
-				auto z = startZ + (k + 0.5) * voxelDepth;
+	double voxelWidth = x_length / dimension;
+	double voxelHeight = y_length / dimension;
+	double voxelDepth = z_length / dimension;
 
-				// project voxel centers into image
-				cv::Point3f center(x, y, z);
-				std::vector<Point3f> centerPoint;
-				centerPoint.push_back(center);
-				std::vector<Point2f> imagePoint;
-				projectPoints(centerPoint, rvec, tvec, cameraMatrix, distCoeffs, imagePoint);
-				int xs = imagePoint[0].x;
-				int ys = imagePoint[0].y;
-				if (xs < 0 || ys < 0 || xs >= mask.size().width || ys >= mask.size().height) {
-					voxel = false;
-					continue;
+	double startX = center[0] - x_length / 2;
+	double startY = center[1] - y_length / 2;
+	double startZ = center[2] - z_length / 2;
+
+	// Every task carves one slab (fixed i) with one view, so even a few views on a small grid fill all cores.
+	// A voxel stays only if no view removes it, the order of the tasks does not matter.
+	int slabs = slabEnd - slabBegin;
+	long tasks = static_cast<long>(views.size()) * slabs;
+	std::vector<LineView> lines;
+	if (rasterize) {
+		// every remaining voxel lies on the silhouette of the last view, which colors them while carving
+		for (size_t v = 0; v < views.size(); v++) lines.push_back(PrepareLineView(views[v], v + 1 == views.size()));
+	}
+	// a voxel removed by several views at once is counted by the one whose atomic clear found it set
+	size_t removed = 0;
+	DispatchDimension(dimension, layout, [&](auto d) {
+		#pragma omp parallel for schedule(dynamic, 2) reduction(+:removed)
+		for (long task = 0; task < tasks; task++) {
+			const View &view = views[task / slabs];
+			int i = slabBegin + static_cast<int>(task % slabs);
+			if (rasterize) {
+				const LineView &line = lines[task / slabs];
+				for (int j = 0; j < d.value(); j++) {
+					cv::Vec3d first(startX + (i + 0.5) * voxelWidth, startY + (j + 0.5) * voxelHeight,
+					                startZ + 0.5 * voxelDepth);
+					removed += CarveRowLine(*this, line, i, j, first, cv::Vec3d(0, 0, voxelDepth));
 				}
-				// compare corresponding pixel to mask
-				if (mask.at<unsigned char>(ys, xs) == 0) {
-					voxel = false;
+				continue;
+			}
+			double maskScaleX = static_cast<double>(view.mask.cols) / view.image.cols;
+			double maskScaleY = static_cast<double>(view.mask.rows) / view.image.rows;
+
+			std::vector<Point3f> row;
+			std::vector<size_t> rowIdx;
+			std::vector<int> rowK;
+			std::vector<Point2f> projected;
+			auto x = startX + (i + 0.5) * voxelWidth;
+			for (int j = 0; j < d.value(); j++) {
+				auto y = startY + (j + 0.5) * voxelHeight;
+
+				// only project the voxels no other view removed yet, all at once
+				row.clear();
+				rowIdx.clear();
+				rowK.clear();
+				ForEachOccupied(*this, d, i, j, [&](int k, size_t idx) {
+					row.emplace_back(x, y, startZ + (k + 0.5) * voxelDepth);
+					rowIdx.push_back(idx);
+					rowK.push_back(k);
+				});
+				if (row.empty()) continue;
+
+				projectPoints(row, view.rotation, view.translation, view.cameraMatrix, view.distCoeffs, projected);
+				for (size_t v = 0; v < row.size(); v++) {
+					int xs = projected[v].x;
+					int ys = projected[v].y;
+					if (xs < 0 || ys < 0 || xs >= view.image.cols || ys >= view.image.rows) {
+						removed += ClearVoxel(rowIdx[v], i, j, rowK[v]);
+						continue;
+					}
+					int xm = projected[v].x * maskScaleX;
+					int ym = projected[v].y * maskScaleY;
+					if (view.mask.at<unsigned char>(ym, xm) == 0) {
+						removed += ClearVoxel(rowIdx[v], i, j, rowK[v]);
+					}
 				}
+			}
+		}
 
-				//image is in BGR notation	
-				voxelsColor[k + dimension * (j + i * dimension)] = (image.at<Vec3b>(ys,xs).val[2]) |
-						(image.at<Vec3b>(ys,xs).val[1] << 8) |
-						(image.at<Vec3b>(ys,xs).val[0] << 16) ;
+		if (rasterize) return;
+		// Sequential carving leaves the color of the last view on every remaining voxel (all views saw it), so the
+		// colors do not depend on which thread finished first.
+		const View &last = views.back();
+		#pragma omp parallel for schedule(dynamic, 2)
+		for (int i = slabBegin; i < slabEnd; i++) {
+			std::vector<Point3f> row;
+			std::vector<size_t> rowIdx;
+			std::vector<Point2f> projected;
+			auto x = startX + (i + 0.5) * voxelWidth;
+			for (int j = 0; j < d.value(); j++) {
+				auto y = startY + (j + 0.5) * voxelHeight;
+				row.clear();
+				rowIdx.clear();
+				ForEachOccupied(*this, d, i, j, [&](int k, size_t idx) {
+					row.emplace_back(x, y, startZ + (k + 0.5) * voxelDepth);
+					rowIdx.push_back(idx);
+				});
+				if (row.empty()) continue;
+
+				projectPoints(row, last.rotation, last.translation, last.cameraMatrix, last.distCoeffs, projected);
+				for (size_t v = 0; v < row.size(); v++) {
+					int xs = projected[v].x;
+					int ys = projected[v].y;
+					if (xs < 0 || ys < 0 || xs >= last.image.cols || ys >= last.image.rows) continue;
+					voxelsColor[rowIdx[v]] = PackColor(last.image.at<Vec3b>(ys, xs));
+				}
 			}
 		}
-	}
+	});
+	return removed;
 }
 
 //// code for debugging the frustum and voxel container while carving.
@@ -1,26 +1,178 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <opencv2/opencv.hpp>
 
+#include "Dimension.h"
+
+struct DecimateOptions;
+
+/// Occupancy bits packed into 64 bit words. Bits may be cleared from several threads at once with clear_atomic and
+/// clear_range, everything else needs exclusive access.
+class VoxelBits {
+private:
+	std::vector<uint64_t> words;
+	size_t bits = 0;
+
+public:
+	VoxelBits() = default;
+
+	VoxelBits(size_t size, bool value);
+
+	inline size_t size() const { return bits; }
+
+	inline bool operator[](size_t i) const { return (words[i >> 6] >> (i & 63)) & 1u; }
+
+	inline void set(size_t i, bool value) {
+		uint64_t bit = uint64_t(1) << (i & 63);
+		words[i >> 6] = value ? words[i >> 6] | bit : words[i >> 6] & ~bit;
+	}
+
+	/// Clears bit i from any thread. Returns whether it was set, so that every cleared bit is counted exactly once.
+	inline bool clear_atomic(size_t i) {
+		uint64_t bit = uint64_t(1) << (i & 63);
+		uint64_t &word = words[i >> 6];
+		uint64_t old;
+		#pragma omp atomic capture
+		{ old = word; word &= ~bit; }
+		return old & bit;
+	}
+
+	/// Word containing bit i, read atomically so it can be used while other threads clear bits.
+	inline uint64_t word_atomic(size_t i) const {
+		uint64_t word;
+		#pragma omp atomic read
+		word = words[i >> 6];
+		return word;
+	}
+
+	/// Clears the bits begin <= i < end from any thread, every word is cleared atomically. Returns the number of bits
+	/// that were set, so that a bit cleared by overlapping ranges at once is counted by exactly one of them.
+	size_t clear_range(size_t begin, size_t end);
+
+	/// Number of set bits.
+	size_t count() const;
+
+	/// Byte b of the packed bits, bit i is bit i % 8 of byte i / 8.
+	inline uint8_t byte(size_t b) const { return static_cast<uint8_t>(words[b >> 3] >> (8 * (b & 7))); }
+
+	inline void set_byte(size_t b, uint8_t value) {
+		int shift = 8 * (b & 7);
+		words[b >> 3] = (words[b >> 3] & ~(uint64_t(0xFF) << shift)) | (uint64_t(value) << shift);
+	}
+};
+
 class Grid {
 public:
 	Grid(int dim, float x, float y, float z);
 
+	/// Full grid with the given voxel order. Dimensions without a Morton specialization (see SupportsMorton) stay
+	/// Linear.
+	Grid(int dim, float x, float y, float z, VoxelLayout layout);
+
+	/// Grid around a box that is not centered on the first marker (see BoundsEstimator).
+	Grid(int dim, float x, float y, float z, cv::Vec3f center, VoxelLayout layout);
+
+	/// Only the voxels with slabBegin <= i < slabEnd of a dim^3 grid, e.g. one shard of a grid that does not fit into
+	/// memory. Carving leaves the other voxels alone, marching cubes treats them as empty. Slabs are always Linear.
+	Grid(int dim, float x, float y, float z, int slabBegin, int slabEnd);
+
 	bool WriteMesh(const std::string &filename);
 	bool WriteMeshColor(const std::string& filename);
+	/// Reduce the mesh with Mesh::Decimate before writing it.
+	bool WriteMeshColor(const std::string& filename, const DecimateOptions &decimate);
+
+	/// Highest image pyramid level at which the nearest voxel still covers pixelsPerVoxel mask pixels, when seen from
+	/// a camera at t (marker pose in camera space).
+	int MaskLevel(const cv::Mat &cam, cv::Vec3d t, double pixelsPerVoxel, int maxLevel) const;
 
+	/// cam has to match the resolution of the mask (see ScaleCameraMatrix).
 	void Carve(cv::Vec3d t, cv::Vec3d r, cv::Mat mask, cv::Mat cam);
 
 	/// Carve according to a plane given by a normal and the projection of any point on the plane (= shortest distance
 	/// to the origin * |n|)
 	void CarveClipPlane(cv::Vec3d n, double orig);
+
+	/// Same arguments as CarveClipPlane, voxels stay if they are inside all planes.
+	struct ClipPlane {
+		cv::Vec3d normal;
+		double orig;
+	};
+
+	/// Carve with several planes in one pass, clearing whole runs of every row.
+	void CarveClipPlanes(const std::vector<ClipPlane> &planes);
+	/// cameraMatrix has to match the resolution of the mask (see ScaleCameraMatrix).
 	void CarveMask(cv::InputArray tvec, cv::InputArray rvec, cv::Mat mask, cv::InputArray cameraMatrix, cv::InputArray distCoeffs);
-	void CarveMaskColor(cv::InputArray tvec, cv::InputArray rvec, cv::Mat mask, cv::InputArray cameraMatrix, cv::InputArray distCoeffs,cv::Mat image);
+	/// cameraMatrix belongs to the image, the mask may be smaller (e.g. segmented on a lower pyramid level).
+	/// Returns the number of voxels removed.
+	size_t CarveMaskColor(cv::InputArray tvec, cv::InputArray rvec, cv::Mat mask, cv::InputArray cameraMatrix, cv::InputArray distCoeffs,cv::Mat image);
+
+	/// One input of CarveViews, same meaning as the arguments of CarveMaskColor.
+	struct View {
+		cv::Vec3d translation, rotation;
+		cv::Mat mask, cameraMatrix, distCoeffs, image;
+	};
+
+	/// Carve several views at once. Views and slabs of the grid are processed concurrently, voxels are cleared with
+	/// atomic bit operations. The colors of the remaining voxels are taken from the last view afterwards, so the
+	/// surface is the same as calling CarveMaskColor for the views in order.
+	/// With rasterize, every row of voxels is carved by walking its projection through the (undistorted) mask pixel
+	/// by pixel instead of projecting every voxel. Voxels whose centers project onto a pixel border may end up on the
+	/// other side than with projectPoints. The last view colors the voxels on its silhouette during that walk (from
+	/// its undistorted image), so no pass over the remaining voxels follows.
+	/// Returns the number of voxels removed by all views together, a voxel removed by several views is counted once.
+	size_t CarveViews(const std::vector<View> &views, bool rasterize = false);
+
+	/// Write the carving state (occupancy and colors) in a binary format. The file is in Linear order whatever the
+	/// layout of the grid.
+	bool Save(std::ostream &out) const;
+	/// Restore a state written by Save, including the box of the grid. Fails if the stored grid has a different
+	/// dimension.
+	bool Load(std::istream &in);
+
+	/// Edge length in voxels of the bricks whose changes are tracked.
+	static constexpr int brickSize = 16;
+
+	inline int BrickCount() const { return (dimension + brickSize - 1) / brickSize; }
+
+	/// Start recording which bricks lose voxels, every brick starts out as changed. Without it, changedBricks stays
+	/// empty and carving does not pay for the bookkeeping.
+	void TrackChanges();
+
+	/// Record that voxel (i, j, k) was cleared, from any thread.
+	inline void MarkChanged(int i, int j, int k) {
+		if (changedBricks.empty()) return;
+		int n = BrickCount();
+		size_t b = (static_cast<size_t>(i / brickSize) * n + j / brickSize) * n + k / brickSize;
+		#pragma omp atomic write
+		changedBricks[b] = 1;
+	}
+
+	/// Clear voxel (i, j, k) at idx from any thread and record the change. Returns whether it was occupied.
+	inline bool ClearVoxel(size_t idx, int i, int j, int k) {
+		if (!voxels.clear_atomic(idx)) return false;
+		MarkChanged(i, j, k);
+		return true;
+	}
+
+	/// Position of voxel (i, j, k) in voxels and voxelsColor, i has to lie within the slab.
+	inline size_t index(int i, int j, int k) const {
+		if (layout == VoxelLayout::Morton) return MortonIndex(i, j, k);
+		return k + static_cast<size_t>(dimension) * (j + static_cast<size_t>(i - slabBegin) * dimension);
+	}
 
 	float x_length, y_length, z_length;
+	/// middle of the box in marker space, the origin unless the grid was fitted to the object
+	cv::Vec3f center{0, 0, 0};
 	int dimension;
-	std::vector<bool> voxels;
+	int slabBegin, slabEnd;
+	VoxelLayout layout = VoxelLayout::Linear;
+	VoxelBits voxels;
 	std::vector<uint32_t> voxelsColor;
+	/// one flag per brick (bi, bj, bk) at (bi * BrickCount() + bj) * BrickCount() + bk, set when the brick lost voxels
+	/// since the flags were last reset (see LiveMesh). Empty unless TrackChanges was called.
+	std::vector<uint8_t> changedBricks;
 };
\ No newline at end of file
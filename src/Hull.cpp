@@ -0,0 +1,220 @@
+#include "Hull.h"
+#include "ImageSource.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+ContourHull::ContourHull(float x, float y, float z) : x_length(x), y_length(y), z_length(z) {}
+
+void ContourHull::AddView(const Grid::View &view, double epsilon) {
+	Silhouette s;
+	cv::Rodrigues(view.rotation, s.rotation);
+	s.translation = view.translation;
+
+	// the contours are found on the mask, which may be smaller than the image
+	cv::Mat camera = ScaleCameraMatrix(view.cameraMatrix, static_cast<double>(view.mask.cols) / view.image.cols,
+	                                   static_cast<double>(view.mask.rows) / view.image.rows);
+	std::vector<std::vector<cv::Point>> contours;
+	cv::findContours(view.mask, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+
+	s.minX = s.minY = std::numeric_limits<double>::infinity();
+	s.maxX = s.maxY = -std::numeric_limits<double>::infinity();
+	std::vector<cv::Point> polygon;
+	std::vector<cv::Point2d> pixels, normalized;
+	for (auto &contour : contours) {
+		cv::approxPolyDP(contour, polygon, epsilon, true);
+		if (polygon.size() < 3) continue;
+
+		// contours run through the centers of the border pixels
+		pixels.clear();
+		for (auto &point : polygon) pixels.emplace_back(point.x + 0.5, point.y + 0.5);
+		cv::undistortPoints(pixels, normalized, camera, view.distCoeffs);
+		for (size_t v = 0; v < normalized.size(); v++) {
+			auto &a = normalized[v];
+			auto &b = normalized[(v + 1) % normalized.size()];
+			s.edges.emplace_back(a.x, a.y, b.x, b.y);
+			s.minX = std::min(s.minX, a.x);
+			s.maxX = std::max(s.maxX, a.x);
+			s.minY = std::min(s.minY, a.y);
+			s.maxY = std::max(s.maxY, a.y);
+		}
+	}
+
+	// a few edges per band keep point in polygon tests short
+	int bands = std::clamp(static_cast<int>(s.edges.size() / 4), 1, 4096);
+	s.bandHeight = s.edges.empty() ? 1.0 : std::max((s.maxY - s.minY) / bands, 1e-12);
+	s.bandStart.assign(bands + 1, 0);
+	auto bandRange = [&](const cv::Vec4d &edge) {
+		int first = static_cast<int>((std::min(edge[1], edge[3]) - s.minY) / s.bandHeight);
+		int last = static_cast<int>((std::max(edge[1], edge[3]) - s.minY) / s.bandHeight);
+		return std::pair<int, int>(std::clamp(first, 0, bands - 1), std::clamp(last, 0, bands - 1));
+	};
+	for (auto &edge : s.edges) {
+		auto [first, last] = bandRange(edge);
+		for (int band = first; band <= last; band++) s.bandStart[band + 1]++;
+	}
+	for (int band = 0; band < bands; band++) s.bandStart[band + 1] += s.bandStart[band];
+	s.bandEdges.resize(s.bandStart[bands]);
+	std::vector<int> fill(s.bandStart.begin(), s.bandStart.end() - 1);
+	for (int e = 0; e < static_cast<int>(s.edges.size()); e++) {
+		auto [first, last] = bandRange(s.edges[e]);
+		for (int band = first; band <= last; band++) s.bandEdges[fill[band]++] = e;
+	}
+
+	silhouettes.push_back(std::move(s));
+	// the frame buffer of the source is reused for the next frame, the copy reuses ours
+	colorView.translation = view.translation;
+	colorView.rotation = view.rotation;
+	colorView.cameraMatrix = view.cameraMatrix.clone();
+	colorView.distCoeffs = view.distCoeffs.clone();
+	view.image.copyTo(colorView.image);
+}
+
+size_t ContourHull::EdgeCount() const {
+	size_t count = 0;
+	for (auto &s : silhouettes) count += s.edges.size();
+	return count;
+}
+
+bool ContourHull::Inside(const Silhouette &s, double x, double y) const {
+	if (!(x >= s.minX && x <= s.maxX && y >= s.minY && y < s.maxY)) return false;
+	int band = std::min(static_cast<int>((y - s.minY) / s.bandHeight), static_cast<int>(s.bandStart.size()) - 2);
+	// even-odd rule, counting the edges crossed by a ray towards +x
+	bool inside = false;
+	for (int b = s.bandStart[band]; b < s.bandStart[band + 1]; b++) {
+		auto &edge = s.edges[s.bandEdges[b]];
+		if ((edge[1] > y) == (edge[3] > y)) continue;
+		double crossing = edge[0] + (y - edge[1]) * (edge[2] - edge[0]) / (edge[3] - edge[1]);
+		if (crossing > x) inside = !inside;
+	}
+	return inside;
+}
+
+bool ContourHull::Contains(const cv::Vec3d &p) const {
+	if (std::abs(p[0]) > x_length / 2 || std::abs(p[1]) > y_length / 2 || std::abs(p[2]) > z_length / 2) return false;
+	for (auto &s : silhouettes) {
+		cv::Vec3d c = s.rotation * p + s.translation;
+		if (c[2] <= 0 || !Inside(s, c[0] / c[2], c[1] / c[2])) return false;
+	}
+	return true;
+}
+
+double ContourHull::Exit(const Silhouette &s, const cv::Vec3d &a, const cv::Vec3d &d) const {
+	double best = std::numeric_limits<double>::infinity();
+	// the cone ends at the plane of the camera
+	double end = a[2] + d[2];
+	if (end <= 0) best = a[2] / (a[2] - end);
+
+	// the segment crosses the plane through the camera and a polygon edge within the edge, only edges in the bands
+	// covered by the projected segment are candidates
+	int firstBand = 0, lastBand = static_cast<int>(s.bandStart.size()) - 2;
+	if (end > 0) {
+		double ya = a[1] / a[2], yb = (a[1] + d[1]) / end;
+		firstBand = std::max(firstBand, static_cast<int>(std::floor((std::min(ya, yb) - s.minY) / s.bandHeight)));
+		lastBand = std::min(lastBand, static_cast<int>(std::floor((std::max(ya, yb) - s.minY) / s.bandHeight)));
+	}
+	for (int band = firstBand; band <= lastBand; band++) {
+		for (int b = s.bandStart[band]; b < s.bandStart[band + 1]; b++) {
+			auto &edge = s.edges[s.bandEdges[b]];
+			cv::Vec3d e1(edge[0], edge[1], 1), e2(edge[2], edge[3], 1);
+			cv::Vec3d normal = e1.cross(e2);
+			double denominator = normal.dot(d);
+			if (denominator == 0) continue;
+			double t = -normal.dot(a) / denominator;
+			if (t <= 0 || t >= best) continue;
+			cv::Vec3d p = a + t * d;
+			if (p[2] <= 0) continue;
+			cv::Vec2d q(p[0] / p[2] - edge[0], p[1] / p[2] - edge[1]), along(edge[2] - edge[0], edge[3] - edge[1]);
+			double position = q.dot(along);
+			if (position < 0 || position > along.dot(along)) continue;
+			best = t;
+		}
+	}
+	return best;
+}
+
+void ContourHull::Carve(Grid &grid) const {
+	double voxelWidth = grid.x_length / grid.dimension;
+	double voxelHeight = grid.y_length / grid.dimension;
+	double voxelDepth = grid.z_length / grid.dimension;
+
+	double startX = grid.center[0] - grid.x_length / 2;
+	double startY = grid.center[1] - grid.y_length / 2;
+	double startZ = grid.center[2] - grid.z_length / 2;
+
+	int dim = grid.dimension;
+	#pragma omp parallel for
+	for (int i = grid.slabBegin; i < grid.slabEnd; i++) {
+		for (int j = 0; j < dim; j++) {
+			for (int k = 0; k < dim; k++) {
+				cv::Vec3d center(startX + (i + 0.5) * voxelWidth, startY + (j + 0.5) * voxelHeight,
+				                 startZ + (k + 0.5) * voxelDepth);
+				if (!Contains(center)) grid.ClearVoxel(grid.index(i, j, k), i, j, k);
+			}
+		}
+	}
+}
+
+void ContourHull::Extract(Mesh &mesh, int dimension) const {
+	cv::Vec3d size(x_length / dimension, y_length / dimension, z_length / dimension);
+	cv::Vec3d start(-x_length / 2, -y_length / 2, -z_length / 2);
+	auto point = [&](const std::array<int, 3> &sample) {
+		return cv::Vec3d(start[0] + (sample[0] + 0.5) * size[0], start[1] + (sample[1] + 0.5) * size[1],
+		                 start[2] + (sample[2] + 0.5) * size[2]);
+	};
+
+	auto occupancy = [&](int i, std::vector<uint8_t> &plane) {
+		#pragma omp parallel for
+		for (int j = 0; j < dimension; j++) {
+			for (int k = 0; k < dimension; k++) {
+				plane[static_cast<size_t>(j) * dimension + k] = Contains(point({i, j, k}));
+			}
+		}
+	};
+
+	auto vertex = [&](const std::array<int, 3> &inside, const std::array<int, 3> &outside) {
+		cv::Vec3d a = point(inside), d = point(outside) - a;
+		// samples outside the lattice lie half a voxel beyond the box
+		double t = std::numeric_limits<double>::infinity();
+		for (int axis = 0; axis < 3; axis++) {
+			if (outside[axis] < 0 || outside[axis] >= dimension) t = 0.5;
+		}
+		for (auto &s : silhouettes) {
+			t = std::min(t, Exit(s, s.rotation * a + s.translation, s.rotation * d));
+		}
+		// only through rounding when the outside sample lies exactly on a cone
+		if (!(t <= 1)) t = 0.5;
+		cv::Vec3d p = a + t * d;
+		return std::array<float, 3>{static_cast<float>(p[0]), static_cast<float>(p[1]), static_cast<float>(p[2])};
+	};
+
+	const cv::Mat &image = colorView.image;
+	auto color = [&](const std::array<float, 3> &a, const std::array<float, 3> &b, const std::array<float, 3> &c) {
+		RGB rgb{128, 128, 128, 255};
+		if (image.empty()) return rgb;
+		std::vector<cv::Point3f> center{cv::Point3f((a[0] + b[0] + c[0]) / 3, (a[1] + b[1] + c[1]) / 3,
+		                                            (a[2] + b[2] + c[2]) / 3)};
+		std::vector<cv::Point2f> projected;
+		cv::projectPoints(center, colorView.rotation, colorView.translation, colorView.cameraMatrix,
+		                  colorView.distCoeffs, projected);
+		int u = static_cast<int>(projected[0].x), v = static_cast<int>(projected[0].y);
+		if (u < 0 || v < 0 || u >= image.cols || v >= image.rows) return rgb;
+		auto &bgr = image.at<cv::Vec3b>(v, u);
+		return RGB{bgr[0], bgr[1], bgr[2], 255};
+	};
+
+	MarchLattice({dimension, dimension, dimension}, occupancy, vertex, color, mesh);
+}
+
+bool ContourHull::WriteMeshColor(const std::string &filename, int dimension, const DecimateOptions &decimate) const {
+	std::ofstream outFile(filename);
+	if (!outFile.is_open()) return false;
+
+	Mesh m;
+	Extract(m, dimension);
+	m.Decimate(decimate);
+	m.WriteOffColor(outFile);
+
+	return true;
+}
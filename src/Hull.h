@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "Grid.h"
+#include "Mesh.h"
+
+/// Visual hull as the intersection of the silhouette cones of all views, without any voxels. Every view keeps the
+/// contours of its mask simplified to polygons (findContours and approxPolyDP), so memory grows with the complexity
+/// of the contours instead of the volume. Whether a point lies inside is decided exactly, and the surface vertices lie
+/// exactly on the cones instead of halfway between voxel centers.
+class ContourHull {
+private:
+	/// polygons of one view in normalized (undistorted) image coordinates
+	struct Silhouette {
+		cv::Matx33d rotation;
+		cv::Vec3d translation;
+		/// polygon edges (x1, y1, x2, y2), the even-odd rule decides what is inside, so holes need no special care
+		std::vector<cv::Vec4d> edges;
+		/// the edges overlapping every horizontal band of the bounding box, bandEdges[bandStart[b]..bandStart[b+1])
+		std::vector<int> bandStart, bandEdges;
+		double minX, minY, maxX, maxY, bandHeight;
+	};
+
+	float x_length, y_length, z_length;
+	std::vector<Silhouette> silhouettes;
+	/// the faces take their colors from the last view, as with the grid
+	Grid::View colorView;
+
+	bool Inside(const Silhouette &s, double x, double y) const;
+	/// Smallest t in (0, 1] at which a + t * d (camera coordinates, a inside the cone) leaves the cone, infinity if it
+	/// stays inside.
+	double Exit(const Silhouette &s, const cv::Vec3d &a, const cv::Vec3d &d) const;
+
+public:
+	/// The hull is clipped to a box of the same size and position as a grid with these lengths.
+	ContourHull(float x, float y, float z);
+
+	/// Add the silhouette of a view. epsilon is the largest distance in mask pixels between a contour and its polygon.
+	/// The image is copied, the view may reuse its buffers afterwards.
+	void AddView(const Grid::View &view, double epsilon = 1.0);
+
+	inline size_t ViewCount() const { return silhouettes.size(); }
+
+	/// Number of polygon edges over all views, which the memory and the time per point grow with.
+	size_t EdgeCount() const;
+
+	bool Contains(const cv::Vec3d &p) const;
+
+	/// Clear the voxels of the grid whose centers lie outside, the same as carving it with all views.
+	void Carve(Grid &grid) const;
+
+	/// Surface of the hull. The topology is sampled at the same points as the voxel centers of a grid of this
+	/// dimension, every vertex is placed where its lattice edge leaves the first cone. Small features between the
+	/// samples can be missed, the surface itself has no staircase.
+	void Extract(Mesh &mesh, int dimension) const;
+
+	bool WriteMeshColor(const std::string &filename, int dimension, const DecimateOptions &decimate) const;
+};
@@ -1,4 +1,18 @@
 #include "ImageSource.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+
+cv::Mat ScaleCameraMatrix(const cv::Mat &cameraMatrix, double scaleX, double scaleY) {
+	cv::Mat scaled = cameraMatrix.clone();
+	for (int c = 0; c < 3; c++) {
+		scaled.at<double>(0, c) *= scaleX;
+		scaled.at<double>(1, c) *= scaleY;
+	}
+	return scaled;
+}
 
 ImageSource::ImageSource(const std::string &config_filename) {
 	cv::FileStorage fs(config_filename, cv::FileStorage::READ);
@@ -22,6 +36,8 @@ StillImageSource::StillImageSource(const std::string &image_filename, const std:
 	frame = cv::imread(image_filename, 1);
 }
 
+FrameImageSource::FrameImageSource(const std::string &config_filename) : ImageSource(config_filename) {}
+
 VideoImageSource::VideoImageSource(const std::string &video_filename, const std::string &config_filename)
 		: ImageSource(config_filename), capture(video_filename) {
 	capture >> frame;
@@ -36,5 +52,105 @@ VideoImageSource::~VideoImageSource() = default;
 
 bool VideoImageSource::next() {
 	capture >> frame;
+	frame_index++;
+	return !frame.empty();
+}
+
+bool VideoImageSource::seek(int target) {
+	if (!capture.set(cv::CAP_PROP_POS_FRAMES, target)) {
+		// Not every backend can seek (e.g. live cameras), skip forward by decoding instead.
+		if (target <= frame_index) return target == frame_index;
+		for (; frame_index + 1 < target; frame_index++) {
+			if (!capture.grab()) return false;
+		}
+	}
+	frame_index = target;
+	capture >> frame;
+	return !frame.empty();
+}
+
+int VideoImageSource::skip(int count) {
+	// A live camera only holds a few frames, grabbing more waits for new ones and adds latency instead of removing
+	// it. Backends that report the size of their buffer are limited to it, the others stop at the first grab that had
+	// to wait for the camera (longer than half a frame interval).
+	double buffered = capture.get(cv::CAP_PROP_BUFFERSIZE);
+	if (buffered > 0) count = std::min(count, static_cast<int>(buffered));
+	double fps = get_frame_rate();
+	double wait = fps > 0 ? 0.5 / fps : 0;
+
+	int skipped = 0;
+	while (skipped < count) {
+		auto start = std::chrono::steady_clock::now();
+		if (!capture.grab()) break;
+		skipped++;
+		frame_index++;
+		if (wait > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > wait) break;
+	}
+	return skipped;
+}
+
+double VideoImageSource::get_frame_rate() const {
+	return capture.get(cv::CAP_PROP_FPS);
+}
+
+double VideoImageSource::get_timestamp() const {
+	return capture.get(cv::CAP_PROP_POS_MSEC);
+}
+
+static bool is_image_file(const std::string &name) {
+	auto dot = name.find_last_of('.');
+	if (dot == std::string::npos) return false;
+	std::string ext = name.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+	return ext == "jpg" || ext == "jpeg" || ext == "png";
+}
+
+DirectoryImageSource::DirectoryImageSource(const std::string &directory, const std::string &config_filename)
+		: ImageSource(config_filename) {
+	std::vector<cv::String> all;
+	cv::glob(directory + "/*", all, false);
+	std::copy_if(all.begin(), all.end(), std::back_inserter(files), is_image_file);
+	std::sort(files.begin(), files.end());
+	if (!files.empty()) frame = cv::imread(files.front(), 1);
+}
+
+bool DirectoryImageSource::next() {
+	return seek(index + 1);
+}
+
+bool DirectoryImageSource::seek(int target) {
+	if (target < 0 || target >= static_cast<int>(files.size())) return false;
+	index = target;
+	frame = cv::imread(files[index], 1);
 	return !frame.empty();
-}
\ No newline at end of file
+}
+
+int DirectoryImageSource::skip(int count) {
+	int skipped = std::min(count, static_cast<int>(files.size()) - 1 - index);
+	if (skipped <= 0) return 0;
+	// the frame after the skipped ones is loaded by the next call to next()
+	index += skipped;
+	return skipped;
+}
+
+static bool ends_with(const std::string &str, const std::string &end) {
+	return str.length() >= end.length() && str.compare(str.length() - end.length(), end.length(), end) == 0;
+}
+
+std::unique_ptr<ImageSource> OpenImageSource(const std::string &input, const std::string &config_filename) {
+	char *ptr;
+	long device = std::strtol(input.c_str(), &ptr, 10);
+	if (!input.empty() && !*ptr) {
+		return std::make_unique<VideoImageSource>(static_cast<int>(device), config_filename);
+	}
+	if (std::filesystem::is_directory(input)) {
+		return std::make_unique<DirectoryImageSource>(input, config_filename);
+	}
+	if (ends_with(input, ".png") || ends_with(input, ".jpg")) {
+		return std::make_unique<StillImageSource>(input, config_filename);
+	}
+	if (ends_with(input, ".mp4")) {
+		return std::make_unique<VideoImageSource>(input, config_filename);
+	}
+	return nullptr;
+}
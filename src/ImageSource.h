@@ -1,8 +1,12 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <opencv2/opencv.hpp>
 
+/// Intrinsics for an image resized by the given factors (e.g. 0.5 per pyramid level).
+cv::Mat ScaleCameraMatrix(const cv::Mat &cameraMatrix, double scaleX, double scaleY);
+
 class ImageSource {
 protected:
 	cv::Mat camera_matrix;
@@ -26,6 +30,22 @@ public:
 	virtual bool is_open() const = 0;
 
 	virtual bool next() = 0;
+
+	/// Index of the current frame, counted from the start of the input.
+	virtual int get_frame_index() const { return 0; }
+
+	/// Jump to the given frame. Returns false if the input does not support seeking.
+	virtual bool seek(int) { return false; }
+
+	/// Discard the next frames without decoding them. Returns the number of frames skipped, which may be fewer when
+	/// no more frames are available without waiting (e.g. the buffer of a live camera is empty).
+	virtual int skip(int) { return 0; }
+
+	/// Frames per second of the input, 0 if unknown.
+	virtual double get_frame_rate() const { return 0; }
+
+	/// Capture time of the current frame in milliseconds since the start of the input, negative if unknown.
+	virtual double get_timestamp() const { return -1; }
 };
 
 class StillImageSource : public ImageSource {
@@ -41,6 +61,7 @@ class VideoImageSource : public ImageSource {
 
 private:
 	cv::VideoCapture capture;
+	int frame_index = 0;
 
 public:
 	VideoImageSource(const std::string &video_filename, const std::string &config_filename);
@@ -52,4 +73,51 @@ public:
 	inline bool is_open() const override { return capture.isOpened(); }
 
 	bool next() override;
-};
\ No newline at end of file
+
+	inline int get_frame_index() const override { return frame_index; }
+
+	bool seek(int frame) override;
+
+	int skip(int count) override;
+
+	double get_frame_rate() const override;
+
+	double get_timestamp() const override;
+};
+
+/// Frames handed over by the caller, e.g. when the reconstruction is embedded into another application.
+class FrameImageSource : public ImageSource {
+public:
+	explicit FrameImageSource(const std::string &config_filename);
+
+	inline bool is_open() const override { return !camera_matrix.empty(); }
+
+	inline bool next() override { return false; }
+
+	inline void set_frame(const cv::Mat &image) { frame = image; }
+};
+
+/// All images of a directory in lexicographic order, e.g. a recorded still sequence for replays.
+class DirectoryImageSource : public ImageSource {
+
+private:
+	std::vector<cv::String> files;
+	int index = 0;
+
+public:
+	DirectoryImageSource(const std::string &directory, const std::string &config_filename);
+
+	inline bool is_open() const override { return !frame.empty(); }
+
+	bool next() override;
+
+	inline int get_frame_index() const override { return index; }
+
+	bool seek(int frame) override;
+
+	int skip(int count) override;
+};
+
+/// Open a video (.mp4), a still image (.png, .jpg), a directory of images or a camera (device index as string).
+/// Returns nullptr if the input type is not recognised, the result may still fail is_open().
+std::unique_ptr<ImageSource> OpenImageSource(const std::string &input, const std::string &config_filename);
@@ -0,0 +1,45 @@
+#include "Keyframe.h"
+
+KeyframeSelector::KeyframeSelector(double minAngle, double minDistance, int maxSkipped)
+		: minAngle(minAngle), minDistance(minDistance), maxSkipped(maxSkipped) {}
+
+bool KeyframeSelector::accept(const MarkerTracker::loc &pose) {
+	bool moved = !last || skipped >= maxSkipped;
+
+	if (!moved) {
+		cv::Matx33d rLast, rCur;
+		cv::Rodrigues(last->rotation, rLast);
+		cv::Rodrigues(pose.rotation, rCur);
+
+		// the poses describe the marker in camera space, the camera center in marker space is -R^T * t.
+		cv::Vec3d centerLast = -(rLast.t() * last->translation);
+		cv::Vec3d centerCur = -(rCur.t() * pose.translation);
+
+		// angle of the relative rotation between both camera orientations
+		cv::Vec3d relative;
+		cv::Rodrigues(rLast.t() * rCur, relative);
+
+		moved = cv::norm(relative) >= minAngle || cv::norm(centerCur - centerLast) >= minDistance;
+	}
+
+	if (!moved) {
+		skipped++;
+		return false;
+	}
+
+	last = pose;
+	skipped = 0;
+	return true;
+}
+
+ConvergenceMonitor::ConvergenceMonitor(int frames, size_t minRemoved) : frames(frames), minRemoved(minRemoved) {}
+
+void ConvergenceMonitor::update(size_t removed, int views) {
+	if (views <= 0) return;
+	if (removed < minRemoved * views) {
+		quiet += views;
+	}
+	else {
+		quiet = 0;
+	}
+}
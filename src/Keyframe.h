@@ -0,0 +1,50 @@
+#pragma once
+
+#include <optional>
+#include "Marker.h"
+
+/// Skips frames whose camera pose is almost identical to the last carved frame.
+/// Consecutive video frames hardly add any information to the visual hull, but cost a full segmentation and carving pass.
+class KeyframeSelector {
+private:
+	double minAngle;
+	double minDistance;
+	int maxSkipped;
+
+	int skipped = 0;
+	std::optional<MarkerTracker::loc> last{};
+
+public:
+	/// minAngle in radians and minDistance in meters are the camera motion needed since the last keyframe.
+	/// After maxSkipped rejected frames the next frame is accepted regardless of the motion.
+	KeyframeSelector(double minAngle, double minDistance, int maxSkipped);
+
+	/// Decide whether the frame with the given pose (first marker in camera space) should be carved.
+	/// An accepted frame becomes the new reference.
+	bool accept(const MarkerTracker::loc &pose);
+
+	inline int get_skipped() const { return skipped; }
+};
+
+/// Ends the input once carving converged: when several carved frames in a row hardly remove any voxels, the hull is
+/// already as tight as the camera path makes it and the rest of the input only costs time.
+class ConvergenceMonitor {
+private:
+	int frames;
+	size_t minRemoved;
+
+	int quiet = 0;
+
+public:
+	/// Converged after `frames` consecutive carved frames that each removed fewer than minRemoved voxels.
+	ConvergenceMonitor(int frames, size_t minRemoved);
+
+	/// Report a carving step of `views` frames carved together (e.g. a batch) that removed `removed` voxels. Each frame
+	/// of the step is taken to have removed the average.
+	void update(size_t removed, int views = 1);
+
+	inline bool converged() const { return quiet >= frames; }
+
+	/// Number of consecutive frames below the threshold so far.
+	inline int get_quiet() const { return quiet; }
+};
@@ -1,24 +1,93 @@
 #include "Marker.h"
+#include <algorithm>
 
-Marker::Marker(ImageSource &image, float markerLength)
-		: image(image) {
+MarkerDetector::MarkerDetector(int level) : level(level) {
 	parameters->cornerRefinementMethod = cv::aruco::CORNER_REFINE_CONTOUR;
-	cv::aruco::detectMarkers(image.get_frame(), dictionary, corners, ids, parameters, rejected);
-	cv::aruco::estimatePoseSingleMarkers(corners, markerLength,
-	                                     image.get_camera_matrix(), image.get_distortion_coefficients(),
-	                                     rotationVectors, translationVectors);
+	// cornerSubPix on the full frame replaces the refinement on the coarse level
+	coarseParameters->cornerRefinementMethod = cv::aruco::CORNER_REFINE_NONE;
+}
+
+int MarkerDetector::level_for(const cv::Size &size) const {
+	if (level >= 0) return level;
+	int l = 0;
+	while ((size.width >> l) > maxCoarseWidth) l++;
+	return l;
+}
+
+void MarkerDetector::detect(const cv::Mat &frame, std::vector<std::vector<cv::Point2f>> &corners,
+                            std::vector<int> &ids, std::vector<std::vector<cv::Point2f>> &rejected) {
+	int l = level_for(frame.size());
+	if (l == 0) {
+		cv::aruco::detectMarkers(frame, dictionary, corners, ids, parameters, rejected);
+		return;
+	}
+
+	if (frame.channels() == 1) gray = frame;
+	else cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+	cv::resize(gray, coarse, cv::Size(gray.cols >> l, gray.rows >> l), 0, 0, cv::INTER_AREA);
+	cv::aruco::detectMarkers(coarse, dictionary, corners, ids, coarseParameters, rejected);
+
+	// pixel centers of the coarse level back to the full frame
+	float scaleX = static_cast<float>(gray.cols) / coarse.cols, scaleY = static_cast<float>(gray.rows) / coarse.rows;
+	auto toFull = [&](std::vector<std::vector<cv::Point2f>> &quads) {
+		for (auto &quad : quads) {
+			for (auto &p : quad) p = cv::Point2f((p.x + 0.5f) * scaleX - 0.5f, (p.y + 0.5f) * scaleY - 0.5f);
+		}
+	};
+	toFull(corners);
+	toFull(rejected);
+	if (corners.empty()) return;
+
+	// the coarse corners are off by up to a coarse pixel, the window covers that without reaching the inner cells
+	// of small markers
+	int window = std::clamp(1 << l, 3, 8);
+	std::vector<cv::Point2f> points;
+	for (auto &quad : corners) points.insert(points.end(), quad.begin(), quad.end());
+	cv::cornerSubPix(gray, points, cv::Size(window, window), cv::Size(-1, -1),
+	                 cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 30, 0.01));
+	for (size_t m = 0; m < corners.size(); m++) {
+		std::copy(points.begin() + 4 * m, points.begin() + 4 * (m + 1), corners[m].begin());
+	}
+}
+
+Marker::Marker(ImageSource &image, float markerLength, MarkerDetector &detector, bool singlePoses)
+		: length(markerLength), image(image) {
+	detector.detect(image.get_frame(), corners, ids, rejected);
+	if (singlePoses) {
+		cv::aruco::estimatePoseSingleMarkers(corners, markerLength,
+		                                     image.get_camera_matrix(), image.get_distortion_coefficients(),
+		                                     rotationVectors, translationVectors);
+	}
+}
+
+void Marker::pose(size_t i, cv::Vec3d &rotation, cv::Vec3d &translation) const {
+	if (i < rotationVectors.size()) {
+		rotation = rotationVectors[i];
+		translation = translationVectors[i];
+		return;
+	}
+	std::vector<cv::Vec3d> rotations, translations;
+	cv::aruco::estimatePoseSingleMarkers(std::vector<std::vector<cv::Point2f>>{corners[i]}, length,
+	                                     image.get_camera_matrix(), image.get_distortion_coefficients(), rotations,
+	                                     translations);
+	rotation = rotations.front();
+	translation = translations.front();
 }
 
 cv::Mat Marker::visualize() {
-	cv::Mat img = image.get_frame().clone();
+	cv::Mat img;
+	visualize(img);
+	return img;
+}
+
+void Marker::visualize(cv::Mat &img) {
+	image.get_frame().copyTo(img);
 
 	cv::aruco::drawDetectedMarkers(img, corners, ids);
 
-	for (size_t i = 0; i < ids.size(); i++)
+	for (size_t i = 0; i < rotationVectors.size(); i++)
 		cv::aruco::drawAxis(img, image.get_camera_matrix(), image.get_distortion_coefficients(), rotationVectors[i],
 		                    translationVectors[i], 0.1);
-
-	return img;
 }
 
 inline cv::Vec3d combineRotations(const cv::Vec3d &a, const cv::Vec3d &b) {
@@ -31,7 +100,18 @@ inline cv::Vec3d combineRotations(const cv::Vec3d &a, const cv::Vec3d &b) {
 	return r;
 }
 
+MarkerTracker::MarkerTracker(Mode mode) : mode(mode) {}
+
 std::optional<MarkerTracker::loc> MarkerTracker::getFirstMarkerLoc(Marker &mark) {
+	last = getFirstMarkerLoc(mark, last);
+	return last;
+}
+
+std::optional<MarkerTracker::loc> MarkerTracker::getFirstMarkerLoc(Marker &mark, const std::optional<loc> &previous) {
+	return mode == Mode::Board ? boardLoc(mark, previous) : averageLoc(mark);
+}
+
+std::optional<MarkerTracker::loc> MarkerTracker::averageLoc(Marker &mark) {
 	if (mark.ids.empty()) return {};
 	if (!first) {
 		first = mark.ids.front();
@@ -83,3 +163,169 @@ std::optional<MarkerTracker::loc> MarkerTracker::getFirstMarkerLoc(Marker &mark)
 
 	return firstPose;
 }
+
+// corners of a marker in its own space, in the order detectMarkers returns them
+static std::array<cv::Vec3d, 4> SquareCorners(float length) {
+	double h = length / 2.0;
+	return {cv::Vec3d(-h, h, 0), cv::Vec3d(h, h, 0), cv::Vec3d(h, -h, 0), cv::Vec3d(-h, -h, 0)};
+}
+
+// a marker keeps refining its place in the layout for this many frames, afterwards it costs no pose solve anymore
+static constexpr int boardObservations = 20;
+// mean reprojection error in pixels above which a pose is not trusted
+static constexpr double boardMaxError = 2.0;
+
+std::optional<MarkerTracker::loc> MarkerTracker::boardLoc(Marker &mark, const std::optional<loc> &previous) {
+	if (mark.ids.empty()) return {};
+	if (!first) {
+		first = mark.ids.front();
+		std::cout << "First marker: " << *first << '\n';
+		// the first marker defines the space of the layout and is never refined
+		board.emplace(*first, BoardMarker{SquareCorners(mark.length), boardObservations});
+	}
+
+	auto &cameraMatrix = mark.get_image().get_camera_matrix();
+	auto &distCoeffs = mark.get_image().get_distortion_coefficients();
+
+	// the corners of all markers with a known place in the layout form one board
+	std::vector<cv::Point3d> objectPoints;
+	std::vector<cv::Point2f> imagePoints;
+	// the marker seen most often so far, the fallback when the previous pose is no good guess
+	std::optional<size_t> anchor;
+	for (size_t i = 0; i < mark.ids.size(); i++) {
+		auto known = board.find(mark.ids[i]);
+		if (known == board.end()) continue;
+		for (int c = 0; c < 4; c++) {
+			objectPoints.emplace_back(known->second.corners[c]);
+			imagePoints.push_back(mark.corners[i][c]);
+		}
+		if (!anchor || known->second.observations > board.at(mark.ids[*anchor]).observations) anchor = i;
+	}
+	if (!anchor) return {};
+
+	auto error = [&](const cv::Vec3d &rvec, const cv::Vec3d &tvec) {
+		std::vector<cv::Point2d> projected;
+		cv::projectPoints(objectPoints, rvec, tvec, cameraMatrix, distCoeffs, projected);
+		double sum = 0;
+		for (size_t p = 0; p < projected.size(); p++) sum += cv::norm(projected[p] - cv::Point2d(imagePoints[p]));
+		return sum / projected.size();
+	};
+
+	cv::Vec3d rvec, tvec;
+	bool solved = false;
+	if (previous) {
+		rvec = previous->rotation;
+		tvec = previous->translation;
+		solved = cv::solvePnP(objectPoints, imagePoints, cameraMatrix, distCoeffs, rvec, tvec, true,
+		                      cv::SOLVEPNP_ITERATIVE) && error(rvec, tvec) <= boardMaxError;
+	}
+	if (!solved) {
+		// the four corners of one marker are planar, which needs no initial guess
+		auto &corners = board.at(mark.ids[*anchor]).corners;
+		std::vector<cv::Point3d> anchorObject(corners.begin(), corners.end());
+		cv::solvePnP(anchorObject, mark.corners[*anchor], cameraMatrix, distCoeffs, rvec, tvec, false,
+		             cv::SOLVEPNP_ITERATIVE);
+		if (objectPoints.size() > 4) {
+			cv::solvePnP(objectPoints, imagePoints, cameraMatrix, distCoeffs, rvec, tvec, true, cv::SOLVEPNP_ITERATIVE);
+		}
+	}
+	bool reliable = error(rvec, tvec) <= boardMaxError;
+
+	// place new markers in the layout and refine young ones, only from poses that fit the board well
+	if (reliable) {
+		cv::Matx33d rotation;
+		cv::Rodrigues(rvec, rotation);
+		cv::Matx33d toBoard = rotation.t();
+		for (size_t i = 0; i < mark.ids.size(); i++) {
+			auto known = board.find(mark.ids[i]);
+			if (known != board.end() && known->second.observations >= boardObservations) continue;
+
+			cv::Vec3d markerRotation, markerTranslation;
+			mark.pose(i, markerRotation, markerTranslation);
+			cv::Matx33d toCamera;
+			cv::Rodrigues(markerRotation, toCamera);
+			auto square = SquareCorners(mark.length);
+			std::array<cv::Vec3d, 4> corners;
+			for (int c = 0; c < 4; c++) corners[c] = toBoard * (toCamera * square[c] + markerTranslation - tvec);
+
+			if (known == board.end()) {
+				board.emplace(mark.ids[i], BoardMarker{corners, 1});
+				continue;
+			}
+			auto &layout = known->second;
+			layout.observations++;
+			for (int c = 0; c < 4; c++) layout.corners[c] += (corners[c] - layout.corners[c]) * (1.0 / layout.observations);
+		}
+	}
+
+	// a board that does not fit the corners would carve with a wrong pose, the frame is better skipped
+	if (!reliable) return {};
+	return loc{tvec, rvec};
+}
+
+bool MarkerTracker::save(std::ostream &out) const {
+	int32_t firstId = first.value_or(-1);
+	uint32_t count = markers.size();
+	out.write(reinterpret_cast<const char *>(&firstId), sizeof(firstId));
+	out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+	for (auto &[id, l] : markers) {
+		int32_t markerId = id;
+		out.write(reinterpret_cast<const char *>(&markerId), sizeof(markerId));
+		out.write(reinterpret_cast<const char *>(l.translation.val), sizeof(l.translation.val));
+		out.write(reinterpret_cast<const char *>(l.rotation.val), sizeof(l.rotation.val));
+	}
+
+	uint32_t boardCount = board.size();
+	out.write(reinterpret_cast<const char *>(&boardCount), sizeof(boardCount));
+	for (auto &[id, b] : board) {
+		int32_t markerId = id, observations = b.observations;
+		out.write(reinterpret_cast<const char *>(&markerId), sizeof(markerId));
+		out.write(reinterpret_cast<const char *>(&observations), sizeof(observations));
+		for (auto &corner : b.corners) out.write(reinterpret_cast<const char *>(corner.val), sizeof(corner.val));
+	}
+	return out.good();
+}
+
+bool MarkerTracker::load(std::istream &in) {
+	int32_t firstId;
+	uint32_t count;
+	in.read(reinterpret_cast<char *>(&firstId), sizeof(firstId));
+	in.read(reinterpret_cast<char *>(&count), sizeof(count));
+	if (!in) return false;
+
+	std::unordered_map<int, loc> loaded;
+	for (uint32_t i = 0; i < count; i++) {
+		int32_t markerId;
+		loc l;
+		in.read(reinterpret_cast<char *>(&markerId), sizeof(markerId));
+		in.read(reinterpret_cast<char *>(l.translation.val), sizeof(l.translation.val));
+		in.read(reinterpret_cast<char *>(l.rotation.val), sizeof(l.rotation.val));
+		if (!in) return false;
+		loaded.emplace(markerId, l);
+	}
+
+	// layouts written before board mode existed end here
+	std::unordered_map<int, BoardMarker> loadedBoard;
+	uint32_t boardCount = 0;
+	if (!in.read(reinterpret_cast<char *>(&boardCount), sizeof(boardCount))) {
+		if (in.gcount() != 0 || !in.eof()) return false;
+		in.clear();
+	}
+	for (uint32_t i = 0; i < boardCount; i++) {
+		int32_t markerId, observations;
+		BoardMarker b;
+		in.read(reinterpret_cast<char *>(&markerId), sizeof(markerId));
+		in.read(reinterpret_cast<char *>(&observations), sizeof(observations));
+		for (auto &corner : b.corners) in.read(reinterpret_cast<char *>(corner.val), sizeof(corner.val));
+		if (!in) return false;
+		b.observations = observations;
+		loadedBoard.emplace(markerId, b);
+	}
+
+	markers = std::move(loaded);
+	board = std::move(loadedBoard);
+	last.reset();
+	if (firstId >= 0) first = firstId;
+	else first.reset();
+	return true;
+}
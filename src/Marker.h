@@ -1,32 +1,70 @@
 #pragma once
 
+#include <array>
 #include <unordered_map>
 #include <utility>
+#include <optional>
 #include <opencv2/opencv.hpp>
 #include <opencv2/aruco.hpp>
 #include "ImageSource.h"
 
+/// Finds the markers of frames, created once and reused for every frame (detector parameters, dictionary and image
+/// buffers). Large frames are searched on a lower pyramid level, only the corners of the markers found there are
+/// refined on the full resolution frame with cornerSubPix.
+class MarkerDetector {
+private:
+	//use standard parameters for detection
+	cv::Ptr<cv::aruco::DetectorParameters> parameters = cv::aruco::DetectorParameters::create();
+	cv::Ptr<cv::aruco::DetectorParameters> coarseParameters = cv::aruco::DetectorParameters::create();
+
+	//define the used dictionary
+	cv::Ptr<cv::aruco::Dictionary> dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_4X4_50);
+
+	int level;
+	cv::Mat gray, coarse;
+
+public:
+	/// Frames wider than this are searched on a lower level when the level is chosen automatically.
+	static constexpr int maxCoarseWidth = 2048;
+
+	/// Search on frames downscaled by 2^level, -1 picks the lowest level that is at most maxCoarseWidth wide.
+	explicit MarkerDetector(int level = -1);
+
+	inline void set_level(int l) { level = l; }
+
+	/// The level frames of this size are searched on.
+	int level_for(const cv::Size &size) const;
+
+	void detect(const cv::Mat &frame, std::vector<std::vector<cv::Point2f>> &corners, std::vector<int> &ids,
+	            std::vector<std::vector<cv::Point2f>> &rejected);
+};
+
 class Marker {
 
 public:
 	std::vector<int> ids;
 	std::vector<std::vector<cv::Point2f>> corners, rejected;
 
+	/// poses of the single markers, empty when the constructor was told not to estimate them
 	std::vector<cv::Vec3d> translationVectors;
 	std::vector<cv::Vec3d> rotationVectors;
-private:
-
-	//use standard parameters for detection
-	cv::Ptr<cv::aruco::DetectorParameters> parameters = cv::aruco::DetectorParameters::create();
-
-	//define the used dictionary
-	cv::Ptr<cv::aruco::Dictionary> dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_4X4_50);
 
+	float length;
+private:
 	ImageSource &image;
 public:
-	explicit Marker(ImageSource &image, float markerLength);
+	/// Detect the markers of the frame. Without singlePoses the pose of every marker is only solved on request.
+	Marker(ImageSource &image, float markerLength, MarkerDetector &detector, bool singlePoses = true);
+
+	/// Pose of marker i on its own (marker space to camera space).
+	void pose(size_t i, cv::Vec3d &rotation, cv::Vec3d &translation) const;
+
+	inline const ImageSource &get_image() const { return image; }
 
 	cv::Mat visualize();
+
+	/// Draw into a buffer kept by the caller, which is only reallocated when the frame size changes.
+	void visualize(cv::Mat &img);
 };
 
 class MarkerTracker {
@@ -35,11 +73,49 @@ public:
 		cv::Vec3d translation, rotation;
 	};
 
+	/// How the markers of a frame are combined into the pose of the first marker.
+	enum class Mode {
+		/// average the poses of the single markers
+		Average,
+		/// one PnP solve over the corners of all markers, in a layout learned from the first frames they appear in
+		Board,
+	};
+
+	explicit MarkerTracker(Mode mode = Mode::Average);
+
+	inline Mode get_mode() const { return mode; }
+
+	/// Whether Marker has to estimate the pose of every marker for this tracker.
+	inline bool needs_single_poses() const { return mode == Mode::Average; }
+
 	std::optional<loc> getFirstMarkerLoc(Marker &mark);
 
+	/// Same for one of several cameras sharing the tracker, previous is the last pose of that camera (the initial
+	/// guess of the board solve). Only the marker layout is shared between the cameras.
+	std::optional<loc> getFirstMarkerLoc(Marker &mark, const std::optional<loc> &previous);
+
+	/// Write the learned marker layout in a binary format.
+	bool save(std::ostream &out) const;
+	/// Restore a layout written by save, replacing the current one.
+	bool load(std::istream &in);
+
 private:
+	Mode mode;
+
 	// contains transformations that each marker needs to be multiplied with to get the position and rotation of the
 	// "first" marker.
 	std::unordered_map<int, loc> markers{};
 	std::optional<int> first{};
+
+	/// Corners of a marker in the space of the first marker, averaged over the frames it was seen in so far.
+	struct BoardMarker {
+		std::array<cv::Vec3d, 4> corners;
+		int observations;
+	};
+	std::unordered_map<int, BoardMarker> board{};
+	/// pose of the previous frame passed to getFirstMarkerLoc(mark), the initial guess of the next solve
+	std::optional<loc> last{};
+
+	std::optional<loc> averageLoc(Marker &mark);
+	std::optional<loc> boardLoc(Marker &mark, const std::optional<loc> &previous);
 };
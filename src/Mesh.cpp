@@ -1,5 +1,11 @@
 #include "Mesh.h"
+#include "Dimension.h"
+#include <algorithm>
+#include <istream>
 #include <ostream>
+#include <sstream>
+#include <string>
+#include <omp.h>
 
 size_t Mesh::AddVertex(float x, float y, float z) {
 	verts.push_back(vertex{x, y, z});
@@ -17,6 +23,54 @@ void Mesh::AddVertColor(uint8_t r, uint8_t g, uint8_t b) {
 	vertsColor.push_back(RGB{ r, g, b, 0xFF });
 }
 
+void Mesh::Append(const Mesh &other) {
+	size_t offset = verts.size();
+	verts.insert(verts.end(), other.verts.begin(), other.verts.end());
+	for (auto &f : other.faces) {
+		faces.push_back(triangle{f.v1 + offset, f.v2 + offset, f.v3 + offset});
+	}
+	facesColor.insert(facesColor.end(), other.facesColor.begin(), other.facesColor.end());
+	vertsColor.insert(vertsColor.end(), other.vertsColor.begin(), other.vertsColor.end());
+}
+
+template<typename T>
+static void WriteVector(std::ostream &out, const std::vector<T> &v) {
+	uint64_t size = v.size();
+	out.write(reinterpret_cast<const char *>(&size), sizeof(size));
+	out.write(reinterpret_cast<const char *>(v.data()), size * sizeof(T));
+}
+
+template<typename T>
+static bool ReadVector(std::istream &in, std::vector<T> &v) {
+	uint64_t size = 0;
+	if (!in.read(reinterpret_cast<char *>(&size), sizeof(size))) return false;
+	v.resize(size);
+	return static_cast<bool>(in.read(reinterpret_cast<char *>(v.data()), size * sizeof(T)));
+}
+
+bool Mesh::Save(std::ostream &out) const {
+	WriteVector(out, verts);
+	WriteVector(out, faces);
+	WriteVector(out, facesColor);
+	WriteVector(out, vertsColor);
+	return out.good();
+}
+
+bool Mesh::Load(std::istream &in) {
+	return ReadVector(in, verts) && ReadVector(in, faces) && ReadVector(in, facesColor) && ReadVector(in, vertsColor);
+}
+
+bool Mesh::ReadCounts(std::istream &in, size_t &vertices, size_t &faces) {
+	uint64_t size = 0;
+	if (!in.read(reinterpret_cast<char *>(&size), sizeof(size))) return false;
+	vertices = size;
+	// the faces follow the vertices
+	if (!in.seekg(size * sizeof(vertex), std::ios::cur)) return false;
+	if (!in.read(reinterpret_cast<char *>(&size), sizeof(size))) return false;
+	faces = size;
+	return true;
+}
+
 void Mesh::WriteOff(std::ostream &out) {
 	out << std::fixed;
 	out << "OFF\n";
@@ -35,22 +89,29 @@ void Mesh::WriteOffColor(std::ostream& out) {
 	out << "COFF\n";
 	// verts, faces, edges
 	out << verts.size() << ' ' << faces.size() << " 0\n";
+	WriteOffVertices(out);
+	WriteOffFaces(out, 0);
+}
+
+void Mesh::WriteOffVertices(std::ostream &out) const {
+	out << std::fixed;
 	for (int i = 0; i < verts.size();i++) {
 		out << verts[i].x<< ' ' << verts[i].y << ' ' << verts[i].z  << '\n';
 	}
-	
+}
+
+void Mesh::WriteOffFaces(std::ostream &out, size_t firstVertex) const {
 	for (size_t i = 0; i < faces.size();i++) {
-		out << "3 " << faces[i].v1 
-			<< ' ' << faces[i].v2 
-			<< ' ' << faces[i].v3 
+		out << "3 " << faces[i].v1 + firstVertex
+			<< ' ' << faces[i].v2 + firstVertex
+			<< ' ' << faces[i].v3 + firstVertex
 			<< ' ' << static_cast<int>(facesColor[i].red) 
 			<< ' ' << static_cast<int>(facesColor[i].green) 
 			<< ' ' << static_cast<int>(facesColor[i].blue) << '\n';
 	}
-	
 }
 // Shamelessly stolen from exercise 2.
-int8_t triTable[256][16] = {
+constexpr int8_t triTable[256][16] = {
 		{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
 		{0,  8,  3,  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
 		{0,  1,  9,  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
@@ -313,40 +374,88 @@ int8_t triTable[256][16] = {
 
 
 
-void MarchingCubes(const Grid &g, Mesh &m) {
-	auto at = [&](int x, int y, int z) {
-		auto d = g.dimension;
-		if (x >= d || y >= d || z >= d) return 0u;
-		if (x < 0 || y < 0 || z < 0) return 0u;
-		return (unsigned) g.voxels[z + d * (y + d * x)];
-	};
+// number of triangles of every cube configuration
+static constexpr std::array<uint8_t, 256> triangleCount = [] {
+	std::array<uint8_t, 256> count{};
+	for (int c = 0; c < 256; c++) {
+		while (3 * count[c] < 15 && triTable[c][3 * count[c]] >= 0) count[c]++;
+	}
+	return count;
+}();
+
+// number of corners inside the surface of every cube configuration
+static constexpr std::array<uint8_t, 256> insideCorners = [] {
+	std::array<uint8_t, 256> count{};
+	for (int c = 0; c < 256; c++) {
+		for (int corner = 0; corner < 8; corner++) count[c] += (c >> corner) & 1;
+	}
+	return count;
+}();
+
+// voxels outside the grid (or outside the slab of a shard) are empty
+template<typename Dim>
+static unsigned Occupied(const Grid &g, Dim d, int x, int y, int z) {
+	if (x >= g.slabEnd || y >= d.value() || z >= d.value()) return 0u;
+	if (x < g.slabBegin || y < 0 || z < 0) return 0u;
+	return (unsigned) g.voxels[d.index(x - g.slabBegin, y, z)];
+}
+
+// ijk is the min-corner-voxel of the cell, ijk+111 is max. Corners are numbered as in the diagram in MarchCells.
+template<typename Dim>
+static unsigned CellIndex(const Grid &g, Dim d, int i, int j, int k) {
+	unsigned lut_index = 0;
+	// nearly all cells lie within the slab and need no bounds checks
+	if (i >= g.slabBegin && i + 1 < g.slabEnd && j >= 0 && j + 1 < d.value() && k >= 0 && k + 1 < d.value()) {
+		auto at = [&](int x, int y, int z) { return (unsigned) g.voxels[d.index(x - g.slabBegin, y, z)]; };
+		lut_index |= at(i + 1, j, k) << 0u;
+		lut_index |= at(i, j, k) << 1u;
+		lut_index |= at(i, j + 1, k) << 2u;
+		lut_index |= at(i + 1, j + 1, k) << 3u;
+		lut_index |= at(i + 1, j, k + 1) << 4u;
+		lut_index |= at(i, j, k + 1) << 5u;
+		lut_index |= at(i, j + 1, k + 1) << 6u;
+		lut_index |= at(i + 1, j + 1, k + 1) << 7u;
+		return lut_index;
+	}
+	lut_index |= Occupied(g, d, i + 1, j, k) << 0u;
+	lut_index |= Occupied(g, d, i, j, k) << 1u;
+	lut_index |= Occupied(g, d, i, j + 1, k) << 2u;
+	lut_index |= Occupied(g, d, i + 1, j + 1, k) << 3u;
+	lut_index |= Occupied(g, d, i + 1, j, k + 1) << 4u;
+	lut_index |= Occupied(g, d, i, j, k + 1) << 5u;
+	lut_index |= Occupied(g, d, i, j + 1, k + 1) << 6u;
+	lut_index |= Occupied(g, d, i + 1, j + 1, k + 1) << 7u;
+	return lut_index;
+}
 
+// Calls emit(v1, v2, v3, red, green, blue) for every triangle of the cells begin <= (i, j, k) < end, in cell order.
+template<typename Dim, typename Emit>
+static void MarchCells(const Grid &g, Dim d, std::array<int, 3> begin, std::array<int, 3> end, Emit &&emit) {
 	auto atColor = [&](int x, int y, int z) {
-		auto d = g.dimension;
-		if (x >= d || y >= d || z >= d) return RGB{ 0, 0, 0, 0 };
-		if (x < 0 || y < 0 || z < 0) return RGB{ 0, 0, 0, 0 };
-		return *reinterpret_cast<const RGB*>(&g.voxelsColor[z + d * (y + d * x)]);
+		if (x >= g.slabEnd || y >= d.value() || z >= d.value()) return RGB{ 0, 0, 0, 0 };
+		if (x < g.slabBegin || y < 0 || z < 0) return RGB{ 0, 0, 0, 0 };
+		return *reinterpret_cast<const RGB*>(&g.voxelsColor[d.index(x - g.slabBegin, y, z)]);
 	};
 
 	float voxelWidth = g.x_length / g.dimension;
 	float voxelHeight = g.y_length / g.dimension;
 	float voxelDepth = g.z_length / g.dimension;
 
-	float startX = -g.x_length / 2;
-	float startY = -g.y_length / 2;
-	float startZ = -g.z_length / 2;
+	float startX = g.center[0] - g.x_length / 2;
+	float startY = g.center[1] - g.y_length / 2;
+	float startZ = g.center[2] - g.z_length / 2;
 
 	// The MC-grid is offset by 0.5 voxels from the voxel grid. That means: the centers of voxels (where the values are)
 	// are the corners of the MC-grid. For this reason, the grid resolution is one greater than the voxel resolution.
-	for (int i = -1; i < g.dimension; i++) {
+	for (int i = begin[0]; i < end[0]; i++) {
 		auto x_min = startX + i * voxelWidth;
 		auto x_max = startX + (i + 1) * voxelWidth;
 		auto x_mid = startX + (i + 0.5f) * voxelWidth;
-		for (int j = -1; j < g.dimension; j++) {
+		for (int j = begin[1]; j < end[1]; j++) {
 			auto y_min = startY + j * voxelHeight;
 			auto y_max = startY + (j + 1) * voxelHeight;
 			auto y_mid = startY + (j + 0.5f) * voxelHeight;
-			for (int k = -1; k < g.dimension; k++) {
+			for (int k = begin[2]; k < end[2]; k++) {
 				auto z_min = startZ + k * voxelDepth;
 				auto z_max = startZ + (k + 1) * voxelDepth;
 				auto z_mid = startZ + (k + 0.5f) * voxelDepth;
@@ -363,16 +472,8 @@ void MarchingCubes(const Grid &g, Mesh &m) {
 				 * min 1-----------0
 				 */
 
-				// ijk is the min-corner-voxel. ijk+111 is max.
-				unsigned lut_index = 0;
-				lut_index |= at(i + 1, j, k) << 0u;
-				lut_index |= at(i, j, k) << 1u;
-				lut_index |= at(i, j + 1, k) << 2u;
-				lut_index |= at(i + 1, j + 1, k) << 3u;
-				lut_index |= at(i + 1, j, k + 1) << 4u;
-				lut_index |= at(i, j, k + 1) << 5u;
-				lut_index |= at(i, j + 1, k + 1) << 6u;
-				lut_index |= at(i + 1, j + 1, k + 1) << 7u;
+				unsigned lut_index = CellIndex(g, d, i, j, k);
+				if (triangleCount[lut_index & 0xFFu] == 0) continue;
 
 				std::array<std::array<float, 3>, 12> edges = {
 						std::array{x_mid, y_min, z_min},
@@ -422,35 +523,25 @@ void MarchingCubes(const Grid &g, Mesh &m) {
 				};
 
 
-				auto &lut = triTable[lut_index & 0xFFu]; // stupid table being inverted...
-				for (size_t v = 0; lut[v] >= 0; v += 3) {
-					auto v1 = m.AddVertex(edges[lut[v + 0]]);
-					auto v2 = m.AddVertex(edges[lut[v + 1]]);
-					auto v3 = m.AddVertex(edges[lut[v + 2]]);
-					m.AddFace(v1, v2, v3);
-
-					//add corner, which are inside the surface to the list
-					std::list<int> cornerList;
-					for (int i = 0; i < 8; i++) {
-						if ((lut_index & (1 << i)) >> i) {
-							cornerList.push_back(i);
-						}
-					}
-					
-					int interRed=0;
-					int interGreen=0;
-					int interBlue=0;
-					//interpolation
-					for (auto& corner :  cornerList) {
+				//interpolation of the corners inside the surface, all faces of the cell get the same color
+				int interRed=0;
+				int interGreen=0;
+				int interBlue=0;
+				for (unsigned corner = 0; corner < 8; corner++) {
+					if ((lut_index >> corner) & 1u) {
 						interRed += cornerColors[corner][0];
 						interGreen += cornerColors[corner][1];
 						interBlue += cornerColors[corner][2];
 					}
-					interRed /= cornerList.size();
-					interGreen /= cornerList.size();
-					interBlue /= cornerList.size();
+				}
+				int inside = insideCorners[lut_index & 0xFFu];
+				interRed /= inside;
+				interGreen /= inside;
+				interBlue /= inside;
 
-					m.AddFaceColor(
+				auto &lut = triTable[lut_index & 0xFFu]; // stupid table being inverted...
+				for (size_t v = 0; lut[v] >= 0; v += 3) {
+					emit(edges[lut[v + 0]], edges[lut[v + 1]], edges[lut[v + 2]],
 						static_cast<uint8_t>(interRed), 
 						static_cast<uint8_t>(interGreen),
 						static_cast<uint8_t>(interBlue));
@@ -459,3 +550,241 @@ void MarchingCubes(const Grid &g, Mesh &m) {
 		}
 	}
 }
+
+// Calls emit for every triangle of the cells cellBegin <= i < cellEnd, in cell order.
+template<typename Dim, typename Emit>
+static void MarchCells(const Grid &g, Dim d, int cellBegin, int cellEnd, Emit &&emit) {
+	MarchCells(g, d, {cellBegin, -1, -1}, {cellEnd, d.value(), d.value()}, emit);
+}
+
+void MarchingCubes(const Grid &g, Mesh &m) {
+	MarchingCubes(g, m, -1, g.dimension);
+}
+
+// Adds the triangles of the cells begin <= (i, j, k) < end to m.
+static void MarchingCubes(const Grid &g, Mesh &m, std::array<int, 3> begin, std::array<int, 3> end) {
+	auto emit = [&](std::array<float, 3> &a, std::array<float, 3> &b, std::array<float, 3> &c,
+	                uint8_t red, uint8_t green, uint8_t blue) {
+		auto v1 = m.AddVertex(a);
+		auto v2 = m.AddVertex(b);
+		auto v3 = m.AddVertex(c);
+		m.AddFace(v1, v2, v3);
+		m.AddFaceColor(red, green, blue);
+	};
+	DispatchDimension(g.dimension, g.layout, [&](auto d) { MarchCells(g, d, begin, end, emit); });
+}
+
+void MarchingCubes(const Grid &g, Mesh &m, int cellBegin, int cellEnd) {
+	MarchingCubes(g, m, {cellBegin, -1, -1}, {cellEnd, g.dimension, g.dimension});
+}
+
+size_t LiveMesh::Update(Grid &grid) {
+	if (grid.changedBricks.empty()) grid.TrackChanges();
+	// cells -1 .. dimension - 1
+	int n = grid.dimension / Grid::brickSize + 1;
+	if (n != bricks) {
+		bricks = n;
+		parts.assign(static_cast<size_t>(n) * n * n, Mesh());
+	}
+
+	// Cell i lies between the voxels i and i + 1, so the cells next to a changed voxel brick are in the cell brick of
+	// the same index and the next one along every axis.
+	dirty.assign(parts.size(), 0);
+	int m = grid.BrickCount();
+	for (int bi = 0; bi < m; bi++) {
+		for (int bj = 0; bj < m; bj++) {
+			for (int bk = 0; bk < m; bk++) {
+				auto &changed = grid.changedBricks[(static_cast<size_t>(bi) * m + bj) * m + bk];
+				if (!changed) continue;
+				changed = 0;
+				for (int c = 0; c < 8; c++) {
+					int ci = bi + (c & 1), cj = bj + ((c >> 1) & 1), ck = bk + (c >> 2);
+					if (ci < n && cj < n && ck < n) dirty[(static_cast<size_t>(ci) * n + cj) * n + ck] = 1;
+				}
+			}
+		}
+	}
+	extract.clear();
+	for (size_t b = 0; b < dirty.size(); b++) {
+		if (dirty[b]) extract.push_back(static_cast<int>(b));
+	}
+
+	int size = Grid::brickSize;
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t e = 0; e < extract.size(); e++) {
+		int b = extract[e];
+		std::array<int, 3> brick{b / (n * n), (b / n) % n, b % n};
+		std::array<int, 3> begin, end;
+		for (int a = 0; a < 3; a++) {
+			begin[a] = brick[a] * size - 1;
+			end[a] = std::min((brick[a] + 1) * size, grid.dimension + 1) - 1;
+		}
+		parts[b] = Mesh();
+		MarchingCubes(grid, parts[b], begin, end);
+	}
+	return extract.size();
+}
+
+void LiveMesh::Extract(Mesh &mesh) const {
+	for (auto &part : parts) mesh.Append(part);
+}
+
+size_t LiveMesh::FaceCount() const {
+	size_t faces = 0;
+	for (auto &part : parts) faces += part.FaceCount();
+	return faces;
+}
+
+template<typename Dim>
+static bool WriteOffColorStreaming(const Grid &g, Dim d, std::ostream &out) {
+	// cell slabs i = -1 .. dimension - 1
+	int slabs = g.dimension + 1;
+
+	// pass 1 only counts the faces, for the header and the first face index of every slab
+	std::vector<size_t> firstFace(slabs + 1, 0);
+	#pragma omp parallel for schedule(dynamic, 4)
+	for (int s = 0; s < slabs; s++) {
+		size_t count = 0;
+		for (int j = -1; j < d.value(); j++) {
+			for (int k = -1; k < d.value(); k++) {
+				count += triangleCount[CellIndex(g, d, s - 1, j, k)];
+			}
+		}
+		firstFace[s + 1] = count;
+	}
+	for (int s = 0; s < slabs; s++) firstFace[s + 1] += firstFace[s];
+	size_t faces = firstFace[slabs];
+
+	// the same file as MarchingCubes + Mesh::WriteOffColor: every face has its own three vertices
+	out << std::fixed;
+	out << "COFF\n";
+	out << 3 * faces << ' ' << faces << " 0\n";
+
+	// pass 2 writes the vertices, pass 3 the faces. A few slabs are formatted in parallel and written in order, so only
+	// their text is held in memory.
+	int block = std::max(1, omp_get_max_threads());
+	std::vector<std::string> text(block);
+	for (int pass = 0; pass < 2; pass++) {
+		for (int first = 0; first < slabs; first += block) {
+			int count = std::min(block, slabs - first);
+			#pragma omp parallel for schedule(dynamic)
+			for (int b = 0; b < count; b++) {
+				int s = first + b;
+				size_t face = firstFace[s];
+				std::ostringstream slab;
+				slab << std::fixed;
+				MarchCells(g, d, s - 1, s, [&](std::array<float, 3> &v1, std::array<float, 3> &v2,
+				                            std::array<float, 3> &v3, uint8_t red, uint8_t green, uint8_t blue) {
+					if (pass == 0) {
+						for (auto *v : {&v1, &v2, &v3}) {
+							slab << (*v)[0] << ' ' << (*v)[1] << ' ' << (*v)[2] << '\n';
+						}
+					}
+					else {
+						RGB color{red, green, blue, 0xFF};
+						slab << "3 " << 3 * face << ' ' << 3 * face + 1 << ' ' << 3 * face + 2
+						     << ' ' << static_cast<int>(color.red)
+						     << ' ' << static_cast<int>(color.green)
+						     << ' ' << static_cast<int>(color.blue) << '\n';
+					}
+					face++;
+				});
+				text[b] = slab.str();
+			}
+			for (int b = 0; b < count; b++) {
+				out << text[b];
+				std::string().swap(text[b]);
+			}
+		}
+	}
+	return out.good();
+}
+
+bool WriteOffColorStreaming(const Grid &g, std::ostream &out) {
+	return DispatchDimension(g.dimension, g.layout, [&](auto d) { return WriteOffColorStreaming(g, d, out); });
+}
+
+// corners of a cell as offsets from its min corner, numbered as in the diagram in MarchCells
+static constexpr int cornerOffset[8][3] = {{1, 0, 0}, {0, 0, 0}, {0, 1, 0}, {1, 1, 0},
+                                           {1, 0, 1}, {0, 0, 1}, {0, 1, 1}, {1, 1, 1}};
+// corners at the ends of the edges, in the order of the edge midpoints in MarchCells
+static constexpr int edgeCorners[12][2] = {{1, 0}, {1, 2}, {2, 3}, {0, 3}, {5, 4}, {5, 6},
+                                           {6, 7}, {4, 7}, {0, 4}, {1, 5}, {2, 6}, {3, 7}};
+
+void MarchLattice(const std::array<int, 3> &samples,
+                  const std::function<void(int, std::vector<uint8_t> &)> &occupancy,
+                  const std::function<std::array<float, 3>(const std::array<int, 3> &, const std::array<int, 3> &)> &vertex,
+                  const std::function<RGB(const std::array<float, 3> &, const std::array<float, 3> &,
+                                          const std::array<float, 3> &)> &color,
+                  Mesh &m) {
+	int nx = samples[0], ny = samples[1], nz = samples[2];
+	struct Triangle {
+		std::array<std::array<float, 3>, 3> corners;
+		RGB color;
+	};
+
+	// the two sample layers of the cells i, layer -1 is outside
+	std::vector<uint8_t> below(static_cast<size_t>(ny) * nz, 0), above(below.size());
+	std::vector<std::vector<Triangle>> rows(ny + 1);
+	for (int i = -1; i < nx; i++) {
+		if (i + 1 < nx) {
+			occupancy(i + 1, above);
+		}
+		else {
+			std::fill(above.begin(), above.end(), 0);
+		}
+		auto at = [&](int x, int y, int z) {
+			if (y < 0 || z < 0 || y >= ny || z >= nz) return 0u;
+			return (x == i ? below : above)[static_cast<size_t>(y) * nz + z] ? 1u : 0u;
+		};
+
+		#pragma omp parallel for schedule(dynamic)
+		for (int j = -1; j < ny; j++) {
+			auto &row = rows[j + 1];
+			row.clear();
+			for (int k = -1; k < nz; k++) {
+				unsigned lut_index = 0;
+				for (unsigned corner = 0; corner < 8; corner++) {
+					auto &offset = cornerOffset[corner];
+					lut_index |= at(i + offset[0], j + offset[1], k + offset[2]) << corner;
+				}
+				if (triangleCount[lut_index] == 0) continue;
+
+				// every edge vertex of the cell is placed once
+				std::array<std::array<float, 3>, 12> edges;
+				unsigned placed = 0;
+				auto edge = [&](int e) -> const std::array<float, 3> & {
+					if (!((placed >> e) & 1u)) {
+						auto corner = [&](int c) {
+							auto &offset = cornerOffset[c];
+							return std::array<int, 3>{i + offset[0], j + offset[1], k + offset[2]};
+						};
+						int a = edgeCorners[e][0], b = edgeCorners[e][1];
+						if (!((lut_index >> a) & 1u)) std::swap(a, b);
+						edges[e] = vertex(corner(a), corner(b));
+						placed |= 1u << e;
+					}
+					return edges[e];
+				};
+
+				auto &lut = triTable[lut_index];
+				for (size_t v = 0; lut[v] >= 0; v += 3) {
+					Triangle triangle{{edge(lut[v + 0]), edge(lut[v + 1]), edge(lut[v + 2])}, {}};
+					triangle.color = color(triangle.corners[0], triangle.corners[1], triangle.corners[2]);
+					row.push_back(triangle);
+				}
+			}
+		}
+
+		for (auto &row : rows) {
+			for (auto &triangle : row) {
+				auto v1 = m.AddVertex(triangle.corners[0]);
+				auto v2 = m.AddVertex(triangle.corners[1]);
+				auto v3 = m.AddVertex(triangle.corners[2]);
+				m.AddFace(v1, v2, v3);
+				m.AddFaceColor(triangle.color.red, triangle.color.green, triangle.color.blue);
+			}
+		}
+		std::swap(below, above);
+	}
+}
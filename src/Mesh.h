@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <array>
+#include <cstdint>
+#include <functional>
 #include <iosfwd>
 #include "Grid.h"
 
@@ -13,6 +15,15 @@ struct RGB {
 	uint8_t alpha;
 };
 
+/// Limits for Mesh::Decimate, it stops at whichever is reached first. All zero keeps the mesh as it is.
+struct DecimateOptions {
+	/// number of faces to reduce to
+	size_t targetFaces = 0;
+	/// largest distance in meters a collapse may move the surface (root of the area weighted mean squared distance of
+	/// the new vertex to the planes of the faces it replaces)
+	double maxError = 0;
+};
+
 class Mesh {
 private:
 	struct vertex {
@@ -39,8 +50,75 @@ public:
 	void AddFaceColor(uint8_t r, uint8_t g, uint8_t b);
 	void AddVertColor(uint8_t r, uint8_t g, uint8_t b);
 
+	/// Add the vertices and faces of another mesh, e.g. the part extracted by another shard.
+	void Append(const Mesh &other);
+
+	/// Merge duplicate vertices and collapse edges by quadric error until the options are met, in parallel over
+	/// spatial clusters. Remaining faces keep their colors.
+	void Decimate(const DecimateOptions &options);
+
+	inline size_t FaceCount() const { return faces.size(); }
+	inline size_t VertexCount() const { return verts.size(); }
+
+	/// Binary format for passing meshes between processes of the same machine.
+	bool Save(std::ostream &out) const;
+	bool Load(std::istream &in);
+
+	/// Vertex and face count of a mesh written by Save, without reading the rest of it.
+	static bool ReadCounts(std::istream &in, size_t &vertices, size_t &faces);
+
 	void WriteOff(std::ostream &out);
 	void WriteOffColor(std::ostream& out);
+
+	/// The vertex and the face lines of WriteOffColor, so that the parts of a larger mesh can be written one after
+	/// another. The faces refer to the vertices from firstVertex on.
+	void WriteOffVertices(std::ostream &out) const;
+	void WriteOffFaces(std::ostream &out, size_t firstVertex) const;
 };
 
 void MarchingCubes(const Grid &g, Mesh &m);
+
+/// Only the cells cellBegin <= i < cellEnd of the grid (-1 to dimension). Cell i lies between the voxels i and i + 1,
+/// both have to be in the slab of the grid unless they are outside the grid.
+void MarchingCubes(const Grid &g, Mesh &m, int cellBegin, int cellEnd);
+
+/// Surface of a grid that is kept up to date while carving. Marching cubes is only run again on the bricks of cells
+/// next to voxels that were cleared since the last update (see Grid::TrackChanges), so an update costs time in
+/// proportion to the change instead of the volume, and the whole surface is at hand at any time.
+/// The faces of bricks that did not change keep the colors of their last extraction. Slabs are not supported.
+class LiveMesh {
+private:
+	/// bricks of cells along each axis, brick b holds the cells b * brickSize - 1 <= i < (b + 1) * brickSize - 1
+	int bricks = 0;
+	std::vector<Mesh> parts;
+	/// scratch buffers of Update
+	std::vector<uint8_t> dirty;
+	std::vector<int> extract;
+
+public:
+	/// Extract the bricks the grid changed in and reset its flags. The first update starts tracking the changes of the
+	/// grid and extracts every brick, so does an update after the grid started tracking again (e.g. a new grid).
+	/// Returns the number of bricks extracted.
+	size_t Update(Grid &grid);
+
+	/// All faces, the same ones as MarchingCubes at the time of the last update but ordered by brick.
+	void Extract(Mesh &mesh) const;
+
+	size_t FaceCount() const;
+};
+
+/// Writes the same file as MarchingCubes followed by Mesh::WriteOffColor without building the mesh: the cells are
+/// marched slab by slab three times (face count for the header, vertices, faces), so memory stays at a few slabs.
+bool WriteOffColorStreaming(const Grid &g, std::ostream &out);
+
+/// Marching cubes of a solid sampled on a lattice of samples[0] x samples[1] x samples[2] points, with the cells and
+/// triangles of the grid version (samples outside the lattice are outside, so the surface is closed).
+/// occupancy(i, plane) sets plane[j * samples[2] + k] for the samples of layer i. vertex(inside, outside) places the
+/// surface point on the lattice edge between two samples, color(a, b, c) returns the color of a triangle. Both are
+/// called concurrently, the triangles are added in cell order.
+void MarchLattice(const std::array<int, 3> &samples,
+                  const std::function<void(int, std::vector<uint8_t> &)> &occupancy,
+                  const std::function<std::array<float, 3>(const std::array<int, 3> &, const std::array<int, 3> &)> &vertex,
+                  const std::function<RGB(const std::array<float, 3> &, const std::array<float, 3> &,
+                                          const std::array<float, 3> &)> &color,
+                  Mesh &m);
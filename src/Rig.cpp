@@ -0,0 +1,141 @@
+#include "Rig.h"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+
+static std::string resolve(const std::filesystem::path &base, const std::string &path) {
+	char *ptr;
+	std::strtol(path.c_str(), &ptr, 10);
+	// camera device indices are kept as they are
+	if (path.empty() || !*ptr || std::filesystem::path(path).is_absolute()) return path;
+	return (base / path).string();
+}
+
+std::unique_ptr<CameraRig> CameraRig::Load(const std::string &filename, SegmentMode mode,
+                                           const std::optional<std::string> &cleanPlate,
+                                           const KeyframeSelector &keyframes) {
+	cv::FileStorage fs(filename, cv::FileStorage::READ);
+	if (!fs.isOpened()) {
+		std::cerr << "error opening rig file " << filename << std::endl;
+		return nullptr;
+	}
+	auto base = std::filesystem::path(filename).parent_path();
+
+	auto rig = std::make_unique<CameraRig>();
+	if (!fs["sync_tolerance"].empty()) rig->tolerance = static_cast<double>(fs["sync_tolerance"]);
+
+	cv::FileNode list = fs["cameras"];
+	for (auto it = list.begin(); it != list.end(); ++it) {
+		cv::FileNode node = *it;
+		std::string input = resolve(base, static_cast<std::string>(node["input"]));
+		std::string config = resolve(base, static_cast<std::string>(node["config"]));
+
+		auto plate = cleanPlate;
+		if (!node["cleanplate"].empty()) plate = resolve(base, static_cast<std::string>(node["cleanplate"]));
+
+		auto source = OpenImageSource(input, config);
+		if (!source || !source->is_open() || source->get_camera_matrix().empty()) {
+			std::cerr << "error opening camera " << input << " with config " << config << std::endl;
+			return nullptr;
+		}
+		auto segmentation = Segmentation::Create(mode, plate);
+		if (!segmentation) {
+			std::cerr << "no background segmentation for camera " << input << std::endl;
+			return nullptr;
+		}
+		rig->cameras.push_back(Camera{input, std::move(source), std::move(segmentation), keyframes});
+	}
+
+	if (rig->cameras.empty()) {
+		std::cerr << "rig file " << filename << " contains no cameras" << std::endl;
+		return nullptr;
+	}
+	if (!rig->synchronize()) {
+		std::cerr << "cameras of " << filename << " have no overlapping frames" << std::endl;
+		return nullptr;
+	}
+	return rig;
+}
+
+bool CameraRig::synchronize() {
+	// without timestamps (e.g. image directories) the cameras are simply read in lockstep
+	for (auto &camera : cameras) {
+		if (camera.source->get_timestamp() < 0) return true;
+	}
+
+	// a camera that dropped frames is ahead of the others, the others are advanced until they catch up
+	while (true) {
+		double latest = 0;
+		for (auto &camera : cameras) latest = std::max(latest, camera.source->get_timestamp());
+
+		bool behind = false;
+		for (auto &camera : cameras) {
+			if (camera.source->get_timestamp() < latest - tolerance) {
+				if (!camera.source->next()) return false;
+				behind = true;
+			}
+		}
+		if (!behind) return true;
+	}
+}
+
+bool CameraRig::next() {
+	int n = static_cast<int>(cameras.size());
+	std::vector<char> ok(n);
+
+	// decoding is independent per camera
+#pragma omp parallel for schedule(dynamic)
+	for (int c = 0; c < n; c++) {
+		ok[c] = cameras[c].source->next();
+	}
+
+	if (std::find(ok.begin(), ok.end(), 0) != ok.end() || !synchronize()) return false;
+	group++;
+	return true;
+}
+
+void CameraRig::detect(float markerLength, int markerLevel, MarkerTracker &tracker) {
+	int n = static_cast<int>(cameras.size());
+
+#pragma omp parallel for schedule(dynamic)
+	for (int c = 0; c < n; c++) {
+		cameras[c].detector.set_level(markerLevel);
+		cameras[c].marker.emplace(*cameras[c].source, markerLength, cameras[c].detector, tracker.needs_single_poses());
+	}
+
+	for (auto &camera : cameras) {
+		// the pose of the previous group is the guess for the camera's own solve
+		camera.location = tracker.getFirstMarkerLoc(*camera.marker, camera.location);
+		camera.carve = camera.location && camera.keyframes.accept(*camera.location);
+	}
+}
+
+void CameraRig::segment(const Grid &grid, float maskResolution, int minLevel) {
+	int n = static_cast<int>(cameras.size());
+
+#pragma omp parallel for schedule(dynamic)
+	for (int c = 0; c < n; c++) {
+		auto &camera = cameras[c];
+		if (!camera.carve) continue;
+
+		int level = 0;
+		if (maskResolution > 0)
+			level = grid.MaskLevel(camera.source->get_camera_matrix(), camera.location->translation, maskResolution, 4);
+		camera.segmentation->set_level(std::max(level, minLevel));
+		camera.segmentation->update(*camera.source);
+	}
+}
+
+int CameraRig::carve(Grid &grid, bool rasterize) {
+	// all views of a group carve concurrently
+	std::vector<Grid::View> views;
+	for (auto &camera : cameras) {
+		if (!camera.carve) continue;
+		views.push_back({camera.location->translation, camera.location->rotation, camera.segmentation->get_mask(),
+		                 camera.source->get_camera_matrix(), camera.source->get_distortion_coefficients(),
+		                 camera.source->get_frame()});
+	}
+	removed = grid.CarveViews(views, rasterize);
+	return static_cast<int>(views.size());
+}
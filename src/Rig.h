@@ -0,0 +1,81 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "Grid.h"
+#include "ImageSource.h"
+#include "Keyframe.h"
+#include "Marker.h"
+#include "Segmentation.h"
+
+/// Several fixed cameras looking at the same marker board, each with its own calibration.
+/// Frames of all cameras are grouped by their timestamps, marker detection and segmentation run in parallel per
+/// camera and all silhouettes of a group carve the same grid.
+///
+/// The rig file is read with cv::FileStorage, relative paths are resolved against the directory of the rig file:
+///
+///     %YAML:1.0
+///     ---
+///     sync_tolerance: 20            # ms, frames further apart are not grouped
+///     cameras:
+///       - { input: "left.mp4", config: "left.yaml" }
+///       - { input: "right.mp4", config: "right.yaml", cleanplate: "right_plate.jpg" }
+class CameraRig {
+public:
+	struct Camera {
+		std::string name;
+		std::unique_ptr<ImageSource> source;
+		std::unique_ptr<Segmentation> segmentation;
+		KeyframeSelector keyframes;
+		MarkerDetector detector{};
+
+		/// results of the current group, location stays until the next detect as the guess for the pose of the camera
+		std::optional<Marker> marker{};
+		std::optional<MarkerTracker::loc> location{};
+		bool carve = false;
+	};
+
+private:
+	std::vector<Camera> cameras;
+	double tolerance = 20;
+	int group = 0;
+	size_t removed = 0;
+
+	/// Advance the cameras that lag behind until all current frames lie within the tolerance.
+	bool synchronize();
+
+public:
+	/// Load the cameras of a rig file. The cleanplate of a camera overrides the given one.
+	/// Returns nullptr and prints the reason if any camera can not be opened.
+	static std::unique_ptr<CameraRig> Load(const std::string &filename, SegmentMode mode,
+	                                       const std::optional<std::string> &cleanPlate,
+	                                       const KeyframeSelector &keyframes);
+
+	/// Read the next group of frames. Returns false when any camera ran out of frames.
+	bool next();
+
+	/// Detect the markers of all cameras in parallel. The poses are resolved afterwards in camera order, as all
+	/// cameras share the marker layout learned by the tracker, each from the previous pose of the same camera.
+	/// See MarkerDetector for markerLevel.
+	void detect(float markerLength, int markerLevel, MarkerTracker &tracker);
+
+	/// Segment the frames of all cameras that have a pose and passed the keyframe selection, in parallel.
+	/// See Grid::MaskLevel for maskResolution, minLevel is the lowest pyramid level used.
+	void segment(const Grid &grid, float maskResolution, int minLevel = 0);
+
+	/// Carve the grid with the silhouettes of the current group, see Grid::CarveViews for rasterize. Returns the
+	/// number of views carved.
+	int carve(Grid &grid, bool rasterize = false);
+
+	/// Voxels removed by the last call of carve.
+	inline size_t get_removed() const { return removed; }
+
+	inline std::vector<Camera> &get_cameras() { return cameras; }
+
+	/// Index of the current group, counted from the first one.
+	inline int get_group_index() const { return group; }
+};
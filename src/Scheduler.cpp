@@ -0,0 +1,64 @@
+#include "Scheduler.h"
+#include <algorithm>
+#include <iostream>
+
+// number of frames after a change before the next one, so a single slow frame does not switch back and forth
+static constexpr int changeCooldown = 5;
+// viewer update interval while drawing is deferred
+static constexpr int deferredDrawInterval = 4;
+
+FrameScheduler::FrameScheduler(double budget, double frameRate, int maxLevel)
+		: budget(budget), frameInterval(frameRate > 0 ? 1.0 / frameRate : 1.0 / 30.0), maxLevel(maxLevel) {}
+
+void FrameScheduler::begin() {
+	start = clock::now();
+}
+
+void FrameScheduler::end() {
+	double elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(clock::now() - start).count();
+	average = frames++ == 0 ? elapsed : 0.8 * average + 0.2 * elapsed;
+
+	// everything the camera delivered while this frame was processed, except the newest one, is already outdated.
+	toDrop = elapsed > budget ? std::max(0, static_cast<int>(elapsed / frameInterval) - 1) : 0;
+
+	if (cooldown > 0) {
+		cooldown--;
+		return;
+	}
+
+	int previous = degradation;
+	if (average > budget && degradation < maxLevel + 1) {
+		degradation++;
+	} else if (average < 0.7 * budget && degradation > 0) {
+		degradation--;
+	}
+
+	if (degradation != previous) {
+		cooldown = changeCooldown;
+		worstDegradation = std::max(worstDegradation, degradation);
+		report_change(std::cerr);
+	}
+}
+
+bool FrameScheduler::should_draw() {
+	if (degradation == 0 || frames % deferredDrawInterval == 0) return true;
+	deferredDraws++;
+	return false;
+}
+
+void FrameScheduler::report_change(std::ostream &out) const {
+	out << "realtime: average frame time " << average * 1000 << "ms (budget " << budget * 1000 << "ms), ";
+	if (degradation == 0) {
+		out << "full quality\n";
+	} else {
+		out << "viewer every " << deferredDrawInterval << " frames";
+		if (get_level() > 0) out << ", segmentation at 1/" << (1 << get_level()) << " resolution";
+		out << '\n';
+	}
+}
+
+void FrameScheduler::report(std::ostream &out) const {
+	out << "realtime: " << frames << " frames processed, " << totalDropped << " stale frames dropped, "
+	    << deferredDraws << " viewer updates deferred, lowest segmentation resolution 1/"
+	    << (1 << std::max(0, worstDegradation - 1)) << std::endl;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <iosfwd>
+
+/// Keeps live input responsive by giving every frame a time budget.
+/// When frames take longer than the budget, the following frames do less work: first the viewer is only updated
+/// every few frames, then segmentation runs on lower pyramid levels. Frames that queued up at the camera while
+/// a slow frame was processed are dropped, so the preview never lags behind the operator.
+class FrameScheduler {
+private:
+	using clock = std::chrono::steady_clock;
+
+	double budget;
+	double frameInterval;
+	int maxLevel;
+
+	clock::time_point start;
+	double average = 0;
+	int frames = 0;
+	int cooldown = 0;
+
+	// 0: full quality, 1: deferred drawing, 2..maxLevel+1: segmentation on pyramid level 1..maxLevel
+	int degradation = 0;
+	int toDrop = 0;
+
+	// statistics for the report
+	long totalDropped = 0;
+	long deferredDraws = 0;
+	int worstDegradation = 0;
+
+	void report_change(std::ostream &out) const;
+
+public:
+	/// budget in seconds per frame. frameRate of the input is used to estimate how many frames went stale,
+	/// pass 0 if unknown.
+	FrameScheduler(double budget, double frameRate, int maxLevel = 3);
+
+	/// Call before a frame is processed.
+	void begin();
+
+	/// Call after a frame was processed. Adapts the work for the next frames.
+	void end();
+
+	/// Number of frames that should be skipped before the next one is processed.
+	inline int frames_to_drop() const { return toDrop; }
+
+	/// Pyramid level for segmentation.
+	inline int get_level() const { return degradation > 1 ? degradation - 1 : 0; }
+
+	/// Whether the viewer should be updated for the current frame.
+	bool should_draw();
+
+	/// Record how many stale frames were actually dropped.
+	inline void dropped(int count) { totalDropped += count; }
+
+	/// Print a summary of everything that was degraded.
+	void report(std::ostream &out) const;
+};
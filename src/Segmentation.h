@@ -1,22 +1,52 @@
 #pragma once
 
+#include <memory>
+#include <optional>
 #include "ImageSource.h"
 
+enum class SegmentMode {
+	Watershed,
+	ChromaBlue,
+	ChromeGreen,
+	ChromaWhite,
+	FirstFrame,
+};
+
 class Segmentation {
 
 protected:
 	cv::Mat mask;
 
+	int level = 0;
+	/// pyramid levels 1..level of the current frame, reused between frames
+	std::vector<cv::Mat> pyramid;
+
+	/// Compute the mask for the given frame, which is already scaled to the pyramid level.
+	virtual void segment(const cv::Mat &frame) = 0;
+
+	/// Scale a filter size given for full resolution frames to the current pyramid level (result stays odd).
+	int scaled_kernel(int size) const;
+
 public:
 	Segmentation() = default;
 
 	virtual ~Segmentation() = default;
 
-	virtual void update(ImageSource &image) = 0;
+	/// Segment the current frame. On level > 0 the mask is smaller than the frame.
+	void update(ImageSource &image);
+
+	/// Segment on a frame downscaled by 2^level (cv::pyrDown), trading mask accuracy for speed.
+	inline void set_level(int l) { level = l; }
+
+	inline int get_level() const { return level; }
 
 	inline cv::Mat &get_mask() { return mask; }
 
 	inline const cv::Mat &get_mask() const { return mask; }
+
+	/// Create the segmentation for a mode. FirstFrame needs the path of the clean plate image.
+	/// Returns nullptr if the mode can not be created.
+	static std::unique_ptr<Segmentation> Create(SegmentMode mode, const std::optional<std::string> &cleanPlate);
 };
 
 class ChromaSegmentation : public Segmentation {
@@ -25,10 +55,15 @@ private:
 	cv::Scalar lower;
 	cv::Scalar upper;
 
+	// intermediate images and the filter of the current level, reused between frames
+	cv::Mat hsv, element;
+	int elementLevel = -1;
+
 public:
 	ChromaSegmentation(cv::Scalar lower, cv::Scalar upper);
 
-	void update(ImageSource &image) override;
+protected:
+	void segment(const cv::Mat &frame) override;
 
 public:
 	static std::unique_ptr<ChromaSegmentation> Green();
@@ -42,17 +77,28 @@ class CleanplateSegmentation : public Segmentation {
 
 protected:
 	cv::Mat firstFrame;
+	cv::Mat scaledFirstFrame;
+	// intermediate images, reused between frames
+	cv::Mat difference, gray;
+
+	void segment(const cv::Mat &frame) override;
 
 public:
 	explicit CleanplateSegmentation(const std::string &cleanPlatePath);
 
-	void update(ImageSource &image) override;
+	inline bool is_open() const { return !firstFrame.empty(); }
 };
 
 class WatershedSegmentation : public Segmentation {
+private:
+	// intermediate images, reused between frames
+	cv::Mat gray, background, blackened, sharp, binary, dist, peaks, markers;
+	std::vector<std::vector<cv::Point>> contours;
+
+protected:
+	void segment(const cv::Mat &frame) override;
+
 public:
 	WatershedSegmentation();
-
-	void update(ImageSource &image) override;
 };
 
@@ -0,0 +1,169 @@
+#include "Shard.h"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+static const char streamMagic[8] = {'3', 'D', 'S', 'M', 'C', 'V', 'S', '1'};
+
+static void WriteDoubles(std::ostream &out, const cv::Mat &m) {
+	cv::Mat values;
+	if (!m.empty()) m.convertTo(values, CV_64F);
+	int32_t rows = values.rows, cols = values.cols;
+	out.write(reinterpret_cast<const char *>(&rows), sizeof(rows));
+	out.write(reinterpret_cast<const char *>(&cols), sizeof(cols));
+	for (int r = 0; r < rows; r++) {
+		out.write(reinterpret_cast<const char *>(values.ptr<double>(r)), cols * sizeof(double));
+	}
+}
+
+static bool ReadDoubles(std::istream &in, cv::Mat &m) {
+	int32_t rows, cols;
+	in.read(reinterpret_cast<char *>(&rows), sizeof(rows));
+	in.read(reinterpret_cast<char *>(&cols), sizeof(cols));
+	if (!in || rows < 0 || cols < 0) return false;
+	m = cv::Mat();
+	if (rows == 0 || cols == 0) return true;
+	m.create(rows, cols, CV_64F);
+	for (int r = 0; r < rows; r++) {
+		in.read(reinterpret_cast<char *>(m.ptr<double>(r)), cols * sizeof(double));
+	}
+	return static_cast<bool>(in);
+}
+
+static void WriteImage(std::ostream &out, const cv::Mat &image) {
+	// lossless and fast, the colors have to match carving in a single process
+	std::vector<uchar> buffer;
+	cv::imencode(".png", image, buffer, {cv::IMWRITE_PNG_COMPRESSION, 1});
+	uint64_t size = buffer.size();
+	out.write(reinterpret_cast<const char *>(&size), sizeof(size));
+	out.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+}
+
+static bool ReadImage(std::istream &in, cv::Mat &image) {
+	uint64_t size;
+	if (!in.read(reinterpret_cast<char *>(&size), sizeof(size))) return false;
+	std::vector<uchar> buffer(size);
+	if (!in.read(reinterpret_cast<char *>(buffer.data()), size)) return false;
+	image = cv::imdecode(buffer, cv::IMREAD_UNCHANGED);
+	return !image.empty();
+}
+
+ViewStreamWriter::ViewStreamWriter(const std::string &filename) : out(filename, std::ios::binary | std::ios::trunc) {
+	out.write(streamMagic, sizeof(streamMagic));
+}
+
+bool ViewStreamWriter::write(const Grid::View &view) {
+	out.write(reinterpret_cast<const char *>(view.translation.val), sizeof(view.translation.val));
+	out.write(reinterpret_cast<const char *>(view.rotation.val), sizeof(view.rotation.val));
+	WriteDoubles(out, view.cameraMatrix);
+	WriteDoubles(out, view.distCoeffs);
+	WriteImage(out, view.mask);
+	WriteImage(out, view.image);
+	out.flush();
+	count++;
+	return out.good();
+}
+
+ViewStreamReader::ViewStreamReader(const std::string &filename) : in(filename, std::ios::binary) {
+	char magic[sizeof(streamMagic)];
+	if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), streamMagic)) {
+		in.close();
+	}
+}
+
+bool ViewStreamReader::read(Grid::View &view) {
+	if (!in.read(reinterpret_cast<char *>(view.translation.val), sizeof(view.translation.val))) return false;
+	in.read(reinterpret_cast<char *>(view.rotation.val), sizeof(view.rotation.val));
+	return ReadDoubles(in, view.cameraMatrix) && ReadDoubles(in, view.distCoeffs) && ReadImage(in, view.mask) &&
+	       ReadImage(in, view.image);
+}
+
+std::pair<int, int> ShardSlab(int dimension, int shards, int index) {
+	return {dimension * index / shards, dimension * (index + 1) / shards};
+}
+
+std::string ShardMeshFile(const ShardSetup &setup, int index) {
+	return setup.stream + "." + std::to_string(index) + ".mesh";
+}
+
+bool RunShard(const ShardSetup &setup, int index, int batch) {
+	auto [begin, end] = ShardSlab(setup.dimension, setup.shards, index);
+
+	// Cell i of marching cubes lies between the voxels i and i + 1 and belongs to the shard that holds voxel i + 1,
+	// the last shard also takes the cell on the far side of the grid. So each shard needs the last voxel layer of the
+	// shard below, which it carves itself.
+	int cellBegin = begin - 1;
+	int cellEnd = index == setup.shards - 1 ? setup.dimension : end - 1;
+	Grid grid(setup.dimension, setup.x_length, setup.y_length, setup.z_length, std::max(begin - 1, 0), end);
+
+	ViewStreamReader reader(setup.stream);
+	if (!reader.is_open()) {
+		std::cerr << "error opening view stream " << setup.stream << std::endl;
+		return false;
+	}
+
+	std::vector<Grid::View> views;
+	Grid::View view;
+	while (reader.read(view)) {
+		views.push_back(view);
+		if (static_cast<int>(views.size()) >= batch) {
+			grid.CarveViews(views, setup.rasterize);
+			views.clear();
+		}
+	}
+	// the colors come from the last view of a batch, which makes the final batch decide them, as in one process
+	grid.CarveViews(views, setup.rasterize);
+
+	Mesh mesh;
+	MarchingCubes(grid, mesh, cellBegin, cellEnd);
+
+	std::ofstream out(ShardMeshFile(setup, index), std::ios::binary | std::ios::trunc);
+	return out.is_open() && mesh.Save(out);
+}
+
+bool MergeShards(const ShardSetup &setup, Mesh &mesh) {
+	for (int index = 0; index < setup.shards; index++) {
+		std::ifstream in(ShardMeshFile(setup, index), std::ios::binary);
+		Mesh part;
+		if (!in.is_open() || !part.Load(in)) {
+			std::cerr << "error reading the surface of shard " << index << std::endl;
+			return false;
+		}
+		mesh.Append(part);
+	}
+	return true;
+}
+
+bool WriteShardsOffColor(const ShardSetup &setup, std::ostream &out) {
+	size_t vertices = 0, faces = 0;
+	for (int index = 0; index < setup.shards; index++) {
+		std::ifstream in(ShardMeshFile(setup, index), std::ios::binary);
+		size_t partVertices, partFaces;
+		if (!in.is_open() || !Mesh::ReadCounts(in, partVertices, partFaces)) {
+			std::cerr << "error reading the surface of shard " << index << std::endl;
+			return false;
+		}
+		vertices += partVertices;
+		faces += partFaces;
+	}
+
+	out << std::fixed;
+	out << "COFF\n";
+	out << vertices << ' ' << faces << " 0\n";
+	// pass 0 writes the vertices, pass 1 the faces, numbered from the first vertex of their shard
+	for (int pass = 0; pass < 2; pass++) {
+		size_t firstVertex = 0;
+		for (int index = 0; index < setup.shards; index++) {
+			std::ifstream in(ShardMeshFile(setup, index), std::ios::binary);
+			Mesh part;
+			if (!in.is_open() || !part.Load(in)) {
+				std::cerr << "error reading the surface of shard " << index << std::endl;
+				return false;
+			}
+			if (pass == 0) part.WriteOffVertices(out);
+			else part.WriteOffFaces(out, firstVertex);
+			firstVertex += part.VertexCount();
+		}
+	}
+	return out.good();
+}
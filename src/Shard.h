@@ -0,0 +1,68 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <utility>
+
+#include "Grid.h"
+#include "Mesh.h"
+
+/// Carving grids that do not fit into the memory of one process: all views are written to a stream file once, then
+/// every shard carves one slab of the grid from that stream and extracts the surface of its cells. Neighbouring
+/// shards carve one common voxel layer, so the merged surface has no seams and equals the one of a single grid.
+struct ShardSetup {
+	int dimension;
+	float x_length, y_length, z_length;
+	int shards;
+	/// view stream written by ViewStreamWriter, the shard meshes are written next to it
+	std::string stream;
+	/// see Grid::CarveViews
+	bool rasterize = false;
+};
+
+/// Appends views (pose, intrinsics, mask and image) to a file. Mask and image are stored as PNG.
+class ViewStreamWriter {
+private:
+	std::ofstream out;
+	int count = 0;
+
+public:
+	explicit ViewStreamWriter(const std::string &filename);
+
+	inline bool is_open() const { return out.is_open(); }
+
+	bool write(const Grid::View &view);
+
+	inline int get_count() const { return count; }
+};
+
+/// Reads the views of a ViewStreamWriter file in order.
+class ViewStreamReader {
+private:
+	std::ifstream in;
+
+public:
+	explicit ViewStreamReader(const std::string &filename);
+
+	inline bool is_open() const { return in.is_open(); }
+
+	/// Returns false at the end of the stream.
+	bool read(Grid::View &view);
+};
+
+/// Voxels begin <= i < end of the given shard.
+std::pair<int, int> ShardSlab(int dimension, int shards, int index);
+
+std::string ShardMeshFile(const ShardSetup &setup, int index);
+
+/// Carve the slab of one shard with all views of the stream, `batch` views at a time (see Grid::CarveViews), and
+/// write the surface of the cells the shard owns.
+bool RunShard(const ShardSetup &setup, int index, int batch);
+
+/// Concatenate the surfaces written by all shards, in order.
+bool MergeShards(const ShardSetup &setup, Mesh &mesh);
+
+/// Writes the same file as MergeShards followed by Mesh::WriteOffColor without building the merged mesh: the counts
+/// are read from the headers of the shard surfaces, then every surface is loaded twice, once for its vertices and once
+/// for its faces. Only one shard's surface is held in memory at a time.
+bool WriteShardsOffColor(const ShardSetup &setup, std::ostream &out);
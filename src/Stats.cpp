@@ -0,0 +1,96 @@
+#include "Stats.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <sys/resource.h>
+
+void Stats::record(const std::string &stage, double seconds) {
+	stages[stage].push_back(seconds);
+}
+
+void Stats::add_frame(const FrameResult &frame) {
+	frames.push_back(frame);
+}
+
+// nearest-rank percentile of sorted samples
+static double percentile(const std::vector<double> &sorted, double p) {
+	auto rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+	return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+static std::string escape(const std::string &s) {
+	std::string out;
+	for (char c : s) {
+		if (c == '"' || c == '\\') out += '\\';
+		out += c;
+	}
+	return out;
+}
+
+void Stats::write_json(std::ostream &out, const std::string &input, double totalSeconds) const {
+	size_t carved = std::count_if(frames.begin(), frames.end(), [](auto &f) { return f.carved; });
+
+	out << std::fixed << std::setprecision(3);
+	out << "{\n";
+	out << "  \"input\": \"" << escape(input) << "\",\n";
+	out << "  \"frames\": " << frames.size() << ",\n";
+	out << "  \"carved_frames\": " << carved << ",\n";
+	out << "  \"total_seconds\": " << totalSeconds << ",\n";
+	out << "  \"frames_per_second\": " << (totalSeconds > 0 ? frames.size() / totalSeconds : 0.0) << ",\n";
+	out << "  \"peak_rss_kb\": " << PeakRssKb() << ",\n";
+
+	out << "  \"stages\": {";
+	bool first = true;
+	for (auto &[name, samples] : stages) {
+		auto sorted = samples;
+		std::sort(sorted.begin(), sorted.end());
+		double sum = 0;
+		for (double s : sorted) sum += s;
+
+		out << (first ? "\n" : ",\n");
+		out << "    \"" << escape(name) << "\": {\"count\": " << sorted.size()
+		    << ", \"mean_ms\": " << sum / sorted.size() * 1000
+		    << ", \"p50_ms\": " << percentile(sorted, 50) * 1000
+		    << ", \"p90_ms\": " << percentile(sorted, 90) * 1000
+		    << ", \"p99_ms\": " << percentile(sorted, 99) * 1000
+		    << ", \"max_ms\": " << sorted.back() * 1000 << "}";
+		first = false;
+	}
+	out << "\n  },\n";
+
+	out << "  \"per_frame\": [";
+	for (size_t i = 0; i < frames.size(); i++) {
+		out << (i ? ",\n" : "\n");
+		out << "    {\"index\": " << frames[i].index << ", \"carved\": " << (frames[i].carved ? "true" : "false")
+		    << ", \"surviving_voxels\": " << frames[i].survivingVoxels
+		    << ", \"removed_voxels\": " << frames[i].removedVoxels << "}";
+	}
+	out << "\n  ]\n}\n";
+}
+
+long PeakRssKb() {
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	// kilobytes on linux
+	return usage.ru_maxrss;
+}
+
+double ReadReportThroughput(const std::string &filename) {
+	std::ifstream in(filename);
+	if (!in.is_open()) return -1;
+	std::stringstream ss;
+	ss << in.rdbuf();
+	std::string content = ss.str();
+
+	const std::string key = "\"frames_per_second\":";
+	auto pos = content.find(key);
+	if (pos == std::string::npos) return -1;
+	try {
+		return std::stod(content.substr(pos + key.size()));
+	} catch (const std::exception &) {
+		return -1;
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+/// Collects per-stage latencies and per-frame results of a run and writes them as a JSON report.
+class Stats {
+public:
+	struct FrameResult {
+		int index;
+		bool carved;
+		size_t survivingVoxels;
+		/// voxels carved while processing this frame (a whole batch on the frame that completed it)
+		size_t removedVoxels;
+	};
+
+private:
+	std::map<std::string, std::vector<double>> stages;
+	std::vector<FrameResult> frames;
+
+public:
+	/// Add one latency sample (in seconds) of a pipeline stage.
+	void record(const std::string &stage, double seconds);
+
+	void add_frame(const FrameResult &frame);
+
+	inline const std::vector<FrameResult> &get_frames() const { return frames; }
+
+	/// Write the report. totalSeconds is the wall time of the whole run, used for the throughput.
+	void write_json(std::ostream &out, const std::string &input, double totalSeconds) const;
+};
+
+/// Peak resident set size of this process in kilobytes.
+long PeakRssKb();
+
+/// Read "frames_per_second" from a report written by Stats::write_json. Returns a negative value on failure.
+double ReadReportThroughput(const std::string &filename);
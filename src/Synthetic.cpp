@@ -0,0 +1,218 @@
+#include "Synthetic.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+std::unique_ptr<Shape> Shape::Create(const std::string &name, double size) {
+	double h = size / 2;
+	if (name == "sphere") {
+		return std::make_unique<Sphere>(cv::Vec3d(0, 0, 0), 0.9 * h);
+	} else if (name == "box") {
+		return std::make_unique<Box>(cv::Vec3d(-0.8 * h, -0.6 * h, -0.4 * h), cv::Vec3d(0.8 * h, 0.6 * h, 0.4 * h));
+	} else if (name == "cylinder") {
+		return std::make_unique<Cylinder>(cv::Vec3d(0, 0, 0), 0.6 * h, 1.6 * h);
+	} else if (name == "dumbbell") {
+		std::vector<std::unique_ptr<Shape>> parts;
+		parts.push_back(std::make_unique<Sphere>(cv::Vec3d(-0.6 * h, 0, 0), 0.35 * h));
+		parts.push_back(std::make_unique<Sphere>(cv::Vec3d(0.6 * h, 0, 0), 0.35 * h));
+		parts.push_back(std::make_unique<Box>(cv::Vec3d(-0.6 * h, -0.1 * h, -0.1 * h),
+		                                      cv::Vec3d(0.6 * h, 0.1 * h, 0.1 * h)));
+		return std::make_unique<Union>(std::move(parts));
+	}
+	return nullptr;
+}
+
+Sphere::Sphere(cv::Vec3d center, double radius) : center(center), radius(radius) {}
+
+bool Sphere::contains(const cv::Vec3d &p) const {
+	auto d = p - center;
+	return d.dot(d) <= radius * radius;
+}
+
+bool Sphere::hit(const cv::Vec3d &origin, const cv::Vec3d &dir) const {
+	auto oc = origin - center;
+	double a = dir.dot(dir);
+	double b = oc.dot(dir);
+	double c = oc.dot(oc) - radius * radius;
+	double disc = b * b - a * c;
+	// the far intersection has to be in front of the camera
+	return disc >= 0 && -b + std::sqrt(disc) > 0;
+}
+
+Box::Box(cv::Vec3d min, cv::Vec3d max) : min(min), max(max) {}
+
+bool Box::contains(const cv::Vec3d &p) const {
+	for (int a = 0; a < 3; a++) {
+		if (p[a] < min[a] || p[a] > max[a]) return false;
+	}
+	return true;
+}
+
+bool Box::hit(const cv::Vec3d &origin, const cv::Vec3d &dir) const {
+	double tNear = -std::numeric_limits<double>::infinity();
+	double tFar = std::numeric_limits<double>::infinity();
+	for (int a = 0; a < 3; a++) {
+		if (dir[a] == 0) {
+			if (origin[a] < min[a] || origin[a] > max[a]) return false;
+			continue;
+		}
+		double t0 = (min[a] - origin[a]) / dir[a];
+		double t1 = (max[a] - origin[a]) / dir[a];
+		tNear = std::max(tNear, std::min(t0, t1));
+		tFar = std::min(tFar, std::max(t0, t1));
+	}
+	return tFar >= tNear && tFar > 0;
+}
+
+Cylinder::Cylinder(cv::Vec3d center, double radius, double height)
+		: center(center), radius(radius), halfHeight(height / 2) {}
+
+bool Cylinder::contains(const cv::Vec3d &p) const {
+	auto d = p - center;
+	return d[0] * d[0] + d[1] * d[1] <= radius * radius && std::abs(d[2]) <= halfHeight;
+}
+
+bool Cylinder::hit(const cv::Vec3d &origin, const cv::Vec3d &dir) const {
+	auto o = origin - center;
+	double tNear = -std::numeric_limits<double>::infinity();
+	double tFar = std::numeric_limits<double>::infinity();
+
+	// mantle, in the xy plane
+	double a = dir[0] * dir[0] + dir[1] * dir[1];
+	double b = o[0] * dir[0] + o[1] * dir[1];
+	double c = o[0] * o[0] + o[1] * o[1] - radius * radius;
+	if (a == 0) {
+		if (c > 0) return false;
+	} else {
+		double disc = b * b - a * c;
+		if (disc < 0) return false;
+		double root = std::sqrt(disc);
+		tNear = (-b - root) / a;
+		tFar = (-b + root) / a;
+	}
+
+	// caps
+	if (dir[2] == 0) {
+		if (std::abs(o[2]) > halfHeight) return false;
+	} else {
+		double t0 = (-halfHeight - o[2]) / dir[2];
+		double t1 = (halfHeight - o[2]) / dir[2];
+		tNear = std::max(tNear, std::min(t0, t1));
+		tFar = std::min(tFar, std::max(t0, t1));
+	}
+	return tFar >= tNear && tFar > 0;
+}
+
+Union::Union(std::vector<std::unique_ptr<Shape>> parts) : parts(std::move(parts)) {}
+
+bool Union::contains(const cv::Vec3d &p) const {
+	return std::any_of(parts.begin(), parts.end(), [&](auto &s) { return s->contains(p); });
+}
+
+bool Union::hit(const cv::Vec3d &origin, const cv::Vec3d &dir) const {
+	return std::any_of(parts.begin(), parts.end(), [&](auto &s) { return s->hit(origin, dir); });
+}
+
+std::vector<SyntheticPose> OrbitPoses(int views, double distance, double minElevation, double maxElevation) {
+	const double goldenAngle = CV_PI * (3 - std::sqrt(5.0));
+	std::vector<SyntheticPose> poses;
+	poses.reserve(views);
+
+	for (int i = 0; i < views; i++) {
+		double h = views > 1 ? static_cast<double>(i) / (views - 1) : 0.5;
+		double elevation = minElevation + h * (maxElevation - minElevation);
+		double azimuth = i * goldenAngle;
+		cv::Vec3d center = distance * cv::Vec3d(std::cos(elevation) * std::cos(azimuth),
+		                                        std::cos(elevation) * std::sin(azimuth), std::sin(elevation));
+
+		// camera axes in grid space: z looks at the origin, y points down, x right
+		cv::Vec3d forward = -center / cv::norm(center);
+		cv::Vec3d up(0, 0, 1);
+		if (std::abs(forward.dot(up)) > 0.999) up = cv::Vec3d(0, 1, 0);
+		cv::Vec3d right = forward.cross(up);
+		right /= cv::norm(right);
+		cv::Vec3d down = forward.cross(right);
+
+		cv::Matx33d rot(right[0], right[1], right[2],
+		                down[0], down[1], down[2],
+		                forward[0], forward[1], forward[2]);
+		SyntheticPose pose;
+		cv::Rodrigues(rot, pose.rotation);
+		pose.translation = -(rot * center);
+		poses.push_back(pose);
+	}
+	return poses;
+}
+
+SyntheticScene::SyntheticScene(const Shape &shape, cv::Mat cameraMatrix, cv::Size imageSize)
+		: shape(shape), cameraMatrix(std::move(cameraMatrix)), imageSize(imageSize) {}
+
+void SyntheticScene::render(const SyntheticPose &pose, cv::Mat &mask) const {
+	cv::Matx33d rot;
+	cv::Rodrigues(pose.rotation, rot);
+	cv::Matx33d toGrid = rot.t();
+	cv::Vec3d origin = -(toGrid * pose.translation);
+	cv::Matx33d invK = cv::Matx33d(cameraMatrix).inv();
+
+	mask.create(imageSize, CV_8UC1);
+
+	#pragma omp parallel for schedule(dynamic, 8)
+	for (int y = 0; y < imageSize.height; y++) {
+		auto *row = mask.ptr<uchar>(y);
+		for (int x = 0; x < imageSize.width; x++) {
+			// through the pixel center, carving truncates projected coordinates
+			cv::Vec3d dir = toGrid * (invK * cv::Vec3d(x + 0.5, y + 0.5, 1));
+			row[x] = shape.hit(origin, dir) ? 255 : 0;
+		}
+	}
+}
+
+void SyntheticScene::voxelize(Grid &grid) const {
+	double voxelWidth = grid.x_length / grid.dimension;
+	double voxelHeight = grid.y_length / grid.dimension;
+	double voxelDepth = grid.z_length / grid.dimension;
+
+	double startX = grid.center[0] - grid.x_length / 2;
+	double startY = grid.center[1] - grid.y_length / 2;
+	double startZ = grid.center[2] - grid.z_length / 2;
+
+	int dim = grid.dimension;
+	for (int i = grid.slabBegin; i < grid.slabEnd; i++) {
+		for (int j = 0; j < dim; j++) {
+			for (int k = 0; k < dim; k++) {
+				cv::Vec3d center(startX + (i + 0.5) * voxelWidth, startY + (j + 0.5) * voxelHeight,
+				                 startZ + (k + 0.5) * voxelDepth);
+				grid.voxels.set(grid.index(i, j, k), shape.contains(center));
+			}
+		}
+	}
+}
+
+double SyntheticScene::accuracy(const Grid &grid, size_t &missing) const {
+	double voxelWidth = grid.x_length / grid.dimension;
+	double voxelHeight = grid.y_length / grid.dimension;
+	double voxelDepth = grid.z_length / grid.dimension;
+
+	double startX = grid.center[0] - grid.x_length / 2;
+	double startY = grid.center[1] - grid.y_length / 2;
+	double startZ = grid.center[2] - grid.z_length / 2;
+
+	int dim = grid.dimension;
+	size_t both = 0, either = 0, lost = 0;
+	#pragma omp parallel for reduction(+:both, either, lost)
+	for (int i = grid.slabBegin; i < grid.slabEnd; i++) {
+		for (int j = 0; j < dim; j++) {
+			for (int k = 0; k < dim; k++) {
+				cv::Vec3d center(startX + (i + 0.5) * voxelWidth, startY + (j + 0.5) * voxelHeight,
+				                 startZ + (k + 0.5) * voxelDepth);
+				bool expected = shape.contains(center);
+				bool carved = grid.voxels[grid.index(i, j, k)];
+				both += expected && carved;
+				either += expected || carved;
+				lost += expected && !carved;
+			}
+		}
+	}
+	missing = lost;
+	return either ? static_cast<double>(both) / either : 1.0;
+}
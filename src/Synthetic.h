@@ -0,0 +1,108 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "Grid.h"
+
+/// Analytic solid in grid space, used to generate scenes with exactly known silhouettes and occupancy.
+class Shape {
+public:
+	virtual ~Shape() = default;
+
+	virtual bool contains(const cv::Vec3d &p) const = 0;
+
+	/// Whether the ray origin + t * dir (t > 0) hits the solid.
+	virtual bool hit(const cv::Vec3d &origin, const cv::Vec3d &dir) const = 0;
+
+	/// Create one of the predefined shapes: "sphere", "box", "cylinder" or "dumbbell" (not convex).
+	/// size is the edge length of the cube the shape fits into. Returns nullptr for unknown names.
+	static std::unique_ptr<Shape> Create(const std::string &name, double size);
+};
+
+class Sphere : public Shape {
+private:
+	cv::Vec3d center;
+	double radius;
+
+public:
+	Sphere(cv::Vec3d center, double radius);
+
+	bool contains(const cv::Vec3d &p) const override;
+
+	bool hit(const cv::Vec3d &origin, const cv::Vec3d &dir) const override;
+};
+
+/// Axis aligned box
+class Box : public Shape {
+private:
+	cv::Vec3d min, max;
+
+public:
+	Box(cv::Vec3d min, cv::Vec3d max);
+
+	bool contains(const cv::Vec3d &p) const override;
+
+	bool hit(const cv::Vec3d &origin, const cv::Vec3d &dir) const override;
+};
+
+/// Cylinder along the z axis with flat caps
+class Cylinder : public Shape {
+private:
+	cv::Vec3d center;
+	double radius, halfHeight;
+
+public:
+	Cylinder(cv::Vec3d center, double radius, double height);
+
+	bool contains(const cv::Vec3d &p) const override;
+
+	bool hit(const cv::Vec3d &origin, const cv::Vec3d &dir) const override;
+};
+
+class Union : public Shape {
+private:
+	std::vector<std::unique_ptr<Shape>> parts;
+
+public:
+	explicit Union(std::vector<std::unique_ptr<Shape>> parts);
+
+	bool contains(const cv::Vec3d &p) const override;
+
+	bool hit(const cv::Vec3d &origin, const cv::Vec3d &dir) const override;
+};
+
+/// A camera of a synthetic scene. Same convention as the marker tracker: grid space to camera space.
+struct SyntheticPose {
+	cv::Vec3d rotation, translation;
+};
+
+/// Cameras looking at the origin, evenly spread over a spherical band (golden angle spiral) between the
+/// given elevations (radians).
+std::vector<SyntheticPose> OrbitPoses(int views, double distance, double minElevation, double maxElevation);
+
+/// Renders exact silhouette masks of a shape, which can be carved directly without marker detection or
+/// segmentation. The intrinsics are distortion free.
+class SyntheticScene {
+private:
+	const Shape &shape;
+	cv::Mat cameraMatrix;
+	cv::Size imageSize;
+
+public:
+	SyntheticScene(const Shape &shape, cv::Mat cameraMatrix, cv::Size imageSize);
+
+	/// Silhouette of the shape as seen by the camera (CV_8UC1, 255 inside)
+	void render(const SyntheticPose &pose, cv::Mat &mask) const;
+
+	/// Set the grid to the ground truth occupancy. Marching cubes of this grid is the expected mesh.
+	void voxelize(Grid &grid) const;
+
+	/// Intersection over union of the carved voxels with the shape. missing counts shape voxels that were carved
+	/// away, which for a correct visual hull only happens through discretization at the silhouette borders.
+	double accuracy(const Grid &grid, size_t &missing) const;
+
+	inline const cv::Mat &get_camera_matrix() const { return cameraMatrix; }
+};
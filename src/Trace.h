@@ -3,6 +3,7 @@
 #include <string>
 #include <utility>
 #include <chrono>
+#include <functional>
 #include <optional>
 #include <iostream>
 
@@ -13,6 +14,11 @@ private:
 	std::ostream &outfile;
 	bool ended = false;
 public:
+	/// Receives the name and duration (in seconds) of every finished trace, e.g. to collect statistics.
+	static inline std::function<void(const std::string &, double)> listener;
+	/// Suppresses the log output.
+	static inline bool quiet = false;
+
 	explicit Trace(std::string name, std::ostream *out = nullptr) : name(std::move(name)),
 	                                                                outfile(out ? *out : std::cerr) {
 		start = std::chrono::high_resolution_clock::now();
@@ -23,7 +29,8 @@ public:
 		auto end = std::chrono::high_resolution_clock::now();
 		auto dur = end - start;
 		double secs = std::chrono::duration_cast<std::chrono::duration<double>>(dur).count();
-		outfile << name << ": " << secs << 's' << std::endl;
+		if (!quiet) outfile << name << ": " << secs << 's' << std::endl;
+		if (listener) listener(name, secs);
 		ended = true;
 	}
 
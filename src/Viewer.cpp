@@ -8,23 +8,23 @@ Viewer::Viewer(const ImageSource& i, const Grid& g)
 	double voxelHeight = grid.y_length / grid.dimension;
 	double voxelDepth = grid.z_length / grid.dimension;
 
-    double startX = -grid.x_length / 2;
-	double startY = -grid.y_length / 2;
-	double startZ = -grid.z_length / 2;
-
-    size_t dim = grid.dimension;
-    size_t dim_sq = dim * dim;
-
-    #pragma omp parallel for shared(buffer) schedule(dynamic, 64)
-    for (size_t i = 0; i < grid.voxels.size(); i++) {
-        size_t x = i / dim_sq;
-        size_t y = (i / dim) % dim;
-        size_t z = i % dim;
-    
-        buffer[i] = cv::Vec3f(
-            startX + (x - 0.5) * voxelWidth, 
-            startY + (y - 0.5) * voxelHeight, 
-            startZ + (z - 0.5) * voxelDepth);
+    double startX = grid.center[0] - grid.x_length / 2;
+	double startY = grid.center[1] - grid.y_length / 2;
+	double startZ = grid.center[2] - grid.z_length / 2;
+
+    int dim = grid.dimension;
+
+    // the points are in the order of the voxels, whatever the layout of the grid
+    #pragma omp parallel for shared(buffer) schedule(dynamic, 1)
+    for (int x = grid.slabBegin; x < grid.slabEnd; x++) {
+        for (int y = 0; y < dim; y++) {
+            for (int z = 0; z < dim; z++) {
+                buffer[grid.index(x, y, z)] = cv::Vec3f(
+                    startX + (x - 0.5) * voxelWidth, 
+                    startY + (y - 0.5) * voxelHeight, 
+                    startZ + (z - 0.5) * voxelDepth);
+            }
+        }
     }
 
 }
@@ -1,5 +1,10 @@
 #include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <functional>
 #include <string>
+#include <spawn.h>
+#include <sys/wait.h>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 #include <omp.h>
@@ -11,16 +16,209 @@
 #include "Grid.h"
 #include "Viewer.h"
 #include "Trace.h"
+#include "Checkpoint.h"
+#include "Keyframe.h"
+#include "Scheduler.h"
+#include "Stats.h"
+#include "Rig.h"
+#include "Shard.h"
+#include "Hull.h"
+#include "Bounds.h"
 
 using namespace cv;
 
-bool ends_with(const std::string& str, const std::string& end) {
-	if (str.length() >= end.length()) {
-		return str.compare(str.length() - end.length(), end.length(), end) == 0;
+extern char **environ;
+
+// reconstructed volume in meters, centered on the first marker
+static constexpr float volumeX = 0.1f, volumeY = 0.1f, volumeZ = 0.05f;
+
+/// Write the mesh and, for replays, the JSON report. Returns the exit code of the run.
+static int finish(Arguments &args, const std::function<bool(const std::string &)> &writeMesh, const Stats &stats,
+                  const std::string &input, std::chrono::steady_clock::time_point runStart) {
+	if (!args.noMesh) {
+		Trace exportMesh("export");
+		if (!writeMesh(args.get_output_filepath("mesh.off"))) {
+			std::cout << "Failed to write mesh!\nCheck file path!" << std::endl;
+			return -1;
+		}
 	}
-	else {
-		return false;
+
+	if (args.replay) {
+		double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+		std::ofstream report(*args.replay);
+		if (!report.is_open()) {
+			std::cerr << "error writing report " << *args.replay << std::endl;
+			return -1;
+		}
+		stats.write_json(report, input, total);
+		std::cout << "Replay: " << stats.get_frames().size() / total << " frames/s, report written to " << *args.replay
+		          << std::endl;
+
+		if (args.baseline) {
+			double expected = ReadReportThroughput(*args.baseline);
+			if (expected <= 0) {
+				std::cerr << "error reading baseline " << *args.baseline << std::endl;
+				return -1;
+			}
+			double actual = stats.get_frames().size() / total;
+			if (actual < expected * (1.0 - args.tolerance)) {
+				std::cerr << "Throughput regression: " << actual << " frames/s, baseline " << expected << " frames/s"
+				          << std::endl;
+				return 2;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/// Write the surface kept by a LiveMesh, brought up to date with the grid first.
+static bool write_live_mesh(const std::string &file, LiveMesh &live, Grid &grid, const DecimateOptions &decimate) {
+	std::ofstream out(file);
+	if (!out.is_open()) return false;
+	// carving recolors the voxels of bricks that lost none, every brick is extracted again so that the colors are
+	// the ones of the normal export
+	grid.TrackChanges();
+	live.Update(grid);
+	Mesh mesh;
+	live.Extract(mesh);
+	mesh.Decimate(decimate);
+	mesh.WriteOffColor(out);
+	return true;
+}
+
+/// Several synchronized cameras, each loop iteration carves the frames of all cameras taken at the same time.
+static int run_rig(Arguments &args, Stats &stats, std::chrono::steady_clock::time_point runStart) {
+	bool headless = args.replay.has_value();
+
+	KeyframeSelector keyframes(args.keyframeAngle * CV_PI / 180.0, args.keyframeDistance, args.keyframeMaxSkip);
+	auto rig = CameraRig::Load(*args.rig, args.mode, args.cleanPlate, keyframes);
+	if (!rig) return -1;
+	auto &cameras = rig->get_cameras();
+
+	Grid grid(args.dimension, volumeX, volumeY, volumeZ, args.layout);
+	std::optional<Viewer> viewer;
+	if (!headless) {
+		viewer.emplace(*cameras.front().source, grid);
+		for (auto &camera : cameras) namedWindow(camera.name, WINDOW_NORMAL);
+	}
+	MarkerTracker markerTracker(args.board ? MarkerTracker::Mode::Board : MarkerTracker::Mode::Average);
+	// drawn into the same buffers every frame
+	std::vector<Mat> markerViews(cameras.size());
+	std::optional<ConvergenceMonitor> convergence;
+	if (args.converge) convergence.emplace(*args.converge, args.convergeVoxels);
+	std::optional<LiveMesh> liveMesh;
+	if (args.liveMesh) liveMesh.emplace();
+	bool has_next = false;
+
+	do {
+		Trace fullFrame("frame " + std::to_string(rig->get_group_index()));
+
+		Trace::call("Marker", [&]() { rig->detect(args.markerLength, args.markerLevel, markerTracker); });
+		Trace::call("Segmentation", [&]() { rig->segment(grid, args.maskResolution); });
+
+		Trace carving("carving");
+		int carved = rig->carve(grid, args.rasterize);
+		carving.end();
+		// every view of the group counts as a carved frame, as in a batch, so --converge-voxels is per view
+		if (convergence && carved > 0) convergence->update(rig->get_removed(), carved);
+		if (liveMesh && carved > 0) Trace::call("mesh", [&]() { liveMesh->Update(grid); });
+
+		if (viewer) {
+			for (size_t c = 0; c < cameras.size(); c++) {
+				cameras[c].marker->visualize(markerViews[c]);
+				imshow(cameras[c].name, markerViews[c]);
+			}
+			Trace draw("draw");
+			viewer->draw();
+		}
+
+		fullFrame.end();
+
+		if (headless) {
+			stats.add_frame({rig->get_group_index(), carved > 0, grid.voxels.count(),
+			                 carved > 0 ? rig->get_removed() : 0});
+		}
+
+		if (convergence && convergence->converged()) {
+			std::cout << "Carving converged at group " << rig->get_group_index() << std::endl;
+			break;
+		}
+
+		char c = headless ? 0 : static_cast<char>(waitKey(1));
+		// ESC Key
+		if (c == 27) break;
+	} while ((has_next = rig->next()));
+
+	if (!has_next && !headless)
+		waitKey(0);
+
+	if (liveMesh) {
+		return finish(args, [&](const std::string &file) {
+			return write_live_mesh(file, *liveMesh, grid, args.decimate);
+		}, stats, *args.rig, runStart);
 	}
+	return finish(args, [&](const std::string &file) { return grid.WriteMeshColor(file, args.decimate); }, stats,
+	              *args.rig, runStart);
+}
+
+/// Carve the first posed keyframes into a coarse grid to bound the object, then rewind the input to where it started.
+/// Live input can not be rewound, carving continues with the next frame.
+static std::optional<GridBounds> bootstrap_bounds(Arguments &args, ImageSource &image, Segmentation &segmentation,
+                                                  MarkerDetector &detector, MarkerTracker &tracker) {
+	Trace trace("bounds");
+	BoundsEstimator bounds(volumeX, volumeY, volumeZ);
+	KeyframeSelector keyframes(args.keyframeAngle * CV_PI / 180.0, args.keyframeDistance, args.keyframeMaxSkip);
+	int start = image.get_frame_index();
+	do {
+		Marker marker(image, args.markerLength, detector, tracker.needs_single_poses());
+		auto location = tracker.getFirstMarkerLoc(marker);
+		if (!location || !keyframes.accept(*location)) continue;
+
+		int level = 0;
+		if (args.maskResolution > 0)
+			level = bounds.get_grid().MaskLevel(image.get_camera_matrix(), location->translation, args.maskResolution,
+			                                    4);
+		segmentation.set_level(level);
+		segmentation.update(image);
+		bounds.AddView({location->translation, location->rotation, segmentation.get_mask(), image.get_camera_matrix(),
+		                image.get_distortion_coefficients(), image.get_frame()});
+	} while (bounds.ViewCount() < *args.fit && image.next());
+
+	if (!image.seek(start)) std::cout << "Input can not be rewound, the frames used for the bounds are not carved\n";
+	return bounds.Bounds();
+}
+
+static ShardSetup shard_setup(Arguments &args) {
+	return ShardSetup{args.dimension, volumeX, volumeY, volumeZ, args.shards, args.get_output_filepath("views.stream"),
+	                  args.rasterize};
+}
+
+/// Start this executable once per shard with --shard-worker and wait for all of them.
+static bool run_shards(Arguments &args) {
+	std::vector<pid_t> workers;
+	bool ok = true;
+	for (int index = 0; index < args.shards && ok; index++) {
+		std::vector<std::string> params{"3dsmc", "--shard-worker=" + std::to_string(index),
+		                                "--shards=" + std::to_string(args.shards),
+		                                "--dimension=" + std::to_string(args.dimension),
+		                                "--carve-batch=" + std::to_string(args.carveBatch), "--output=" + args.output};
+		if (args.rasterize) params.push_back("--rasterize");
+		std::vector<char *> argv;
+		for (auto &param : params) argv.push_back(param.data());
+		argv.push_back(nullptr);
+
+		pid_t pid;
+		ok = posix_spawn(&pid, "/proc/self/exe", nullptr, nullptr, argv.data(), environ) == 0;
+		if (ok) workers.push_back(pid);
+	}
+
+	for (pid_t pid : workers) {
+		int status;
+		ok = waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0 && ok;
+	}
+	if (!ok) std::cerr << "carving shards failed" << std::endl;
+	return ok;
 }
 
 int main(int argc, char** argv) {
@@ -33,16 +231,35 @@ int main(int argc, char** argv) {
 		return -1;
 	}
 
+	if (args.shardWorker) {
+		// all shards run at the same time and share the cores
+		omp_set_num_threads(std::max(1, omp_get_num_procs() / args.shards));
+		return RunShard(shard_setup(args), *args.shardWorker, args.carveBatch) ? 0 : 1;
+	}
+
+	omp_set_num_threads(omp_get_max_threads());
+
+	// replays run without any display and collect statistics instead
+	bool headless = args.replay.has_value();
+	Stats stats;
+	if (headless) {
+		Trace::quiet = true;
+		Trace::listener = [&](const std::string &name, double secs) {
+			// "frame 12" is recorded as stage "frame"
+			stats.record(name.substr(0, name.find(' ')), secs);
+		};
+	}
+	auto runStart = std::chrono::steady_clock::now();
+
+	if (args.rig) {
+		return run_rig(args, stats, runStart);
+	}
+
 	if (args.input.index() == 0) {
 		auto& file = std::get<std::string>(args.input);
 
-		if (ends_with(file, ".png") || ends_with(file, ".jpg")) {
-			image = std::make_unique<StillImageSource>(file, args.config);
-		}
-		else if (ends_with(file, ".mp4")) {
-			image = std::make_unique<VideoImageSource>(file, args.config);
-		}
-		else {
+		image = OpenImageSource(file, args.config);
+		if (!image) {
 			std::cerr << "Unrecognised input type: " << file << std::endl;
 			return -1;
 		}
@@ -59,86 +276,258 @@ int main(int argc, char** argv) {
 		return -1;
 	}
 
-	std::unique_ptr<Segmentation> segmentation;
-
-	switch (args.mode) {
-	case SegmentMode::FirstFrame:
-		segmentation = std::make_unique<CleanplateSegmentation>(args.cleanPlate.value());
-		break;
-	case SegmentMode::ChromaBlue:
-		segmentation = ChromaSegmentation::Blue();
-		break;
-	case SegmentMode::ChromeGreen:
-		segmentation = ChromaSegmentation::Green();
-		break;
-	case SegmentMode::ChromaWhite:
-		segmentation = ChromaSegmentation::White();
-		break;
-	case SegmentMode::Watershed:
-		segmentation = std::make_unique<WatershedSegmentation>();
-		break;
-	default:
-		break;
-	}
+	auto segmentation = Segmentation::Create(args.mode, args.cleanPlate);
 
 	if (!segmentation) {
 		std::cerr << "no background segmentation mode specified" << std::endl;
 		return -1;
 	}
 
-	omp_set_num_threads(omp_get_max_threads());
+	// create voxel grid, with shards this process only writes the views and holds no voxels at all
+	std::unique_ptr<ViewStreamWriter> viewStream;
+	if (args.shards > 1) {
+		viewStream = std::make_unique<ViewStreamWriter>(shard_setup(args).stream);
+		if (!viewStream->is_open()) {
+			std::cerr << "error writing " << shard_setup(args).stream << std::endl;
+			return -1;
+		}
+	}
+	MarkerTracker markerTracker(args.board ? MarkerTracker::Mode::Board : MarkerTracker::Mode::Average);
+	MarkerDetector markerDetector(args.markerLevel);
 
-	// create voxel grid
-	Grid grid(64, 0.1f, 0.1f, 0.05f);
-	Viewer viewer(*image, grid);
+	// with --fit the grid only covers the object, a resumed run takes the box from the checkpoint
+	GridBounds box{{0, 0, 0}, {volumeX, volumeY, volumeZ}};
+	if (args.fit && !args.resume) {
+		if (auto bounds = bootstrap_bounds(args, *image, *segmentation, markerDetector, markerTracker)) {
+			box = *bounds;
+			std::cout << "Grid fitted to " << box.size[0] << " x " << box.size[1] << " x " << box.size[2] << " m\n";
+		}
+		else {
+			std::cerr << "no silhouette to fit the grid to, using the whole volume" << std::endl;
+		}
+	}
+
+	// the shards hold the grid, this process only writes the views. With --hull the silhouettes are kept as polygons,
+	// the grid only serves its box and voxel size (e.g. for the mask level) and holds no voxels either.
+	std::optional<ContourHull> hull;
+	if (args.hull) hull.emplace(volumeX, volumeY, volumeZ);
+	Grid grid = viewStream || hull
+	            ? Grid(args.dimension, volumeX, volumeY, volumeZ, 0, 0)
+	            : Grid(args.dimension, box.size[0], box.size[1], box.size[2], box.center, args.layout);
+	std::optional<Viewer> viewer;
 
 	bool has_next = false;
 
-	namedWindow("markers", WINDOW_NORMAL);
-	namedWindow("segmentation", WINDOW_NORMAL);
-	resizeWindow("markers", 1920, 1080);
-	resizeWindow("segmentation", 1920, 1080);
-	MarkerTracker markerTracker;
+	if (!headless) {
+		// the hull has no voxels to show
+		if (!hull) viewer.emplace(*image, grid);
+		namedWindow("markers", WINDOW_NORMAL);
+		namedWindow("segmentation", WINDOW_NORMAL);
+		resizeWindow("markers", 1920, 1080);
+		resizeWindow("segmentation", 1920, 1080);
+	}
+	KeyframeSelector keyframes(args.keyframeAngle * CV_PI / 180.0, args.keyframeDistance, args.keyframeMaxSkip);
 	int frame_counter = 0;
+	// drawn into the same buffer every frame
+	Mat markerView;
+
+	std::unique_ptr<CheckpointWriter> checkpoints;
+	if (args.checkpoint) {
+		if (args.resume) {
+			auto last = LoadCheckpoint(*args.checkpoint, grid, markerTracker);
+			if (!last) {
+				std::cerr << "error loading checkpoint " << *args.checkpoint << std::endl;
+				return -1;
+			}
+			if (!image->seek(*last + 1)) {
+				std::cerr << "input can not be resumed at frame " << *last + 1 << std::endl;
+				return -1;
+			}
+			frame_counter = *last + 1;
+			std::cout << "Resuming at frame " << frame_counter << '\n';
+			// the checkpoint may have brought a fitted box, which the viewer has to place its points in
+			if (viewer) viewer.emplace(*image, grid);
+		}
+		checkpoints = std::make_unique<CheckpointWriter>(*args.checkpoint);
+	}
+
+	std::optional<ConvergenceMonitor> convergence;
+	if (args.converge) convergence.emplace(*args.converge, args.convergeVoxels);
+	// with --live-mesh the surface follows the carving, only the bricks that changed are extracted again
+	std::optional<LiveMesh> liveMesh;
+	if (args.liveMesh) liveMesh.emplace();
+
+	// with --carve-batch the views are collected and carved concurrently. The masks and frames of a batch are copied
+	// into the buffers of the previous one.
+	std::vector<Grid::View> batch;
+	size_t batchUsed = 0;
+	// returns the number of voxels removed by the batch
+	auto carveBatch = [&]() -> size_t {
+		if (batchUsed == 0) return 0;
+		Trace carving("carving");
+		size_t removed = grid.CarveViews(std::vector<Grid::View>(batch.begin(), batch.begin() + batchUsed),
+		                                 args.rasterize);
+		if (convergence) convergence->update(removed, static_cast<int>(batchUsed));
+		batchUsed = 0;
+		return removed;
+	};
+
+	std::optional<FrameScheduler> scheduler;
+	if (args.realtimeBudget) {
+		scheduler.emplace(*args.realtimeBudget / 1000.0, image->get_frame_rate());
+	}
+
 	do {
+		if (scheduler) scheduler->begin();
+
 		Trace fullFrame("frame " + std::to_string(frame_counter++));
 
 		Trace traceMarker("Marker");
-		Marker marker(*image, args.markerLength);
+		Marker marker(*image, args.markerLength, markerDetector, markerTracker.needs_single_poses());
 		traceMarker.end();		
 
-		Trace::call("Segmentation", [&]() { segmentation->update(*image); });
+		if (!headless) {
+			marker.visualize(markerView);
+			imshow("markers", markerView);
+		}
 
-		imshow("markers", marker.visualize());
-		imshow("segmentation", segmentation->get_mask());
+		// frames without a pose or without enough camera motion are not segmented at all
+		auto location = markerTracker.getFirstMarkerLoc(marker);
+		bool carved = location && keyframes.accept(*location);
+		size_t removed = 0;
+		if (carved) {
+			// segment on the lowest pyramid level that still resolves single voxels
+			int level = 0;
+			if (args.maskResolution > 0)
+				level = grid.MaskLevel(image->get_camera_matrix(), location->translation, args.maskResolution, 4);
+			if (scheduler) level = std::max(level, scheduler->get_level());
+			segmentation->set_level(level);
 
-		if (auto location = markerTracker.getFirstMarkerLoc(marker)) {
-			Trace carving("carving");
-			grid.CarveMaskColor(location->translation, location->rotation, segmentation->get_mask(),
-			               image->get_camera_matrix(), image->get_distortion_coefficients(), image->get_frame());
+			Trace::call("Segmentation", [&]() { segmentation->update(*image); });
+			if (!headless) imshow("segmentation", segmentation->get_mask());
+
+			if (hull) {
+				Trace carving("carving");
+				hull->AddView({location->translation, location->rotation, segmentation->get_mask(),
+				               image->get_camera_matrix(), image->get_distortion_coefficients(), image->get_frame()},
+				              *args.hull);
+			}
+			else if (viewStream) {
+				Trace stream("stream");
+				viewStream->write({location->translation, location->rotation, segmentation->get_mask(),
+				                   image->get_camera_matrix(), image->get_distortion_coefficients(), image->get_frame()});
+			}
+			else if (args.carveBatch > 1) {
+				// the source and the segmentation reuse their buffers, so the batch needs copies
+				if (batch.size() <= batchUsed) batch.emplace_back();
+				auto &view = batch[batchUsed++];
+				view.translation = location->translation;
+				view.rotation = location->rotation;
+				segmentation->get_mask().copyTo(view.mask);
+				view.cameraMatrix = image->get_camera_matrix();
+				view.distCoeffs = image->get_distortion_coefficients();
+				image->get_frame().copyTo(view.image);
+				if (static_cast<int>(batchUsed) >= args.carveBatch) removed = carveBatch();
+			}
+			else if (args.rasterize) {
+				Trace carving("carving");
+				removed = grid.CarveViews({{location->translation, location->rotation, segmentation->get_mask(),
+				                            image->get_camera_matrix(), image->get_distortion_coefficients(),
+				                            image->get_frame()}},
+				                          true);
+			}
+			else {
+				Trace carving("carving");
+				removed = grid.CarveMaskColor(location->translation, location->rotation, segmentation->get_mask(),
+				                              image->get_camera_matrix(), image->get_distortion_coefficients(),
+				                              image->get_frame());
+			}
+			// batches report to the monitor when they are carved
+			if (convergence && args.carveBatch <= 1) convergence->update(removed);
+			if (liveMesh && removed > 0) Trace::call("mesh", [&]() { liveMesh->Update(grid); });
 		}
 
-		{
+		if (viewer && (!scheduler || scheduler->should_draw())) {
 			Trace draw("draw");
-			viewer.draw();
+			viewer->draw();
+		}
+
+		if (checkpoints && (image->get_frame_index() + 1) % args.checkpointInterval == 0) {
+			removed += carveBatch();
+			checkpoints->submit(image->get_frame_index(), grid, markerTracker);
 		}
 
 		fullFrame.end();
 
-		char c = static_cast<char>(waitKey(1));
+		if (headless) {
+			stats.add_frame({image->get_frame_index(), carved, grid.voxels.count(), removed});
+		}
+
+		if (convergence && convergence->converged()) {
+			std::cout << "Carving converged at frame " << image->get_frame_index() << std::endl;
+			break;
+		}
+
+		if (scheduler) {
+			scheduler->end();
+			scheduler->dropped(image->skip(scheduler->frames_to_drop()));
+		}
+
+		char c = headless ? 0 : static_cast<char>(waitKey(1));
 		// ESC Key
-		if (c == 27) break;
+		if (c == 27) {
+			// keep the progress so the remaining frames can be processed later
+			carveBatch();
+			if (checkpoints) checkpoints->submit(image->get_frame_index(), grid, markerTracker);
+			break;
+		}
 	} while ((has_next = image->next()));
 
+	carveBatch();
+
+	if (scheduler) scheduler->report(std::cout);
+
 	// Quit immediately if video/stream was stopped via ESC key
-	if (!has_next)
+	if (!has_next && !headless)
 		waitKey(0);
 
-	if (!grid.WriteMeshColor(args.get_output_filepath("mesh.off"))) {
-		std::cout << "Failed to write mesh!\nCheck file path!" << std::endl;
-		return -1;
-	}
-	
+	auto input = args.input.index() == 0 ? std::get<std::string>(args.input)
+	                                     : "camera " + std::to_string(std::get<int>(args.input));
 
-	return 0;
+	if (viewStream) {
+		viewStream.reset();
+		{
+			Trace shards("shards");
+			if (!run_shards(args)) return -1;
+		}
+		int result = finish(args, [&](const std::string &file) {
+			std::ofstream out(file);
+			if (!out.is_open()) return false;
+			// without decimation the merged mesh never has to be in memory
+			if (args.decimate.targetFaces == 0 && args.decimate.maxError <= 0) {
+				return WriteShardsOffColor(shard_setup(args), out);
+			}
+			Mesh mesh;
+			if (!MergeShards(shard_setup(args), mesh)) return false;
+			mesh.Decimate(args.decimate);
+			mesh.WriteOffColor(out);
+			return true;
+		}, stats, input, runStart);
+		// the stream holds every carved frame, do not leave it lying around. The shard surfaces were read by the export.
+		for (int index = 0; index < args.shards; index++) std::remove(ShardMeshFile(shard_setup(args), index).c_str());
+		std::remove(shard_setup(args).stream.c_str());
+		return result;
+	}
+	if (hull) {
+		return finish(args, [&](const std::string &file) {
+			return hull->WriteMeshColor(file, args.dimension, args.decimate);
+		}, stats, input, runStart);
+	}
+	if (liveMesh) {
+		return finish(args, [&](const std::string &file) {
+			return write_live_mesh(file, *liveMesh, grid, args.decimate);
+		}, stats, input, runStart);
+	}
+	return finish(args, [&](const std::string &file) { return grid.WriteMeshColor(file, args.decimate); }, stats, input,
+	              runStart);
 }